@@ -7,6 +7,19 @@
 class VideoReader {
 public:
   enum class SCALAR_TYPE : int32_t { U8, U16 };
+  // layout of `VRImage::data`. Planar YUV is stored like OpenCV does it:
+  // a single channel image of `height * 3 / 2` rows, the luma plane
+  // followed by chroma planes of `height / 2` rows each.
+  //   YUV420P: U then V plane, `stride / 2` bytes between rows
+  //   NV12: interleaved UV plane, `stride` bytes between rows
+  enum class PIXEL_FORMAT : int32_t {
+    RGB24,
+    BGR24,
+    RGBA,
+    GRAY8,
+    YUV420P,
+    NV12
+  };
   struct VRImage {
     int32_t height;
     int32_t width;
@@ -16,6 +29,7 @@ public:
     uint8_t* data;  // pointer to the first pixel
     void*
         user_data;  // user supplied data, useful for freeing in DeallocateCallback
+    PIXEL_FORMAT pixel_format;
   };
 
   /**
@@ -69,12 +83,69 @@ public:
    */
   using FrameUP = std::unique_ptr<Frame>;
 
+  /**
+   * The type that "next_frames" returns. Frames are stored one after
+   * another in a single allocation, for interleaved pixel formats
+   * it is an N×H×W×C tensor
+   */
+  struct Batch {
+    // `tensor->image` has `n * frame_height` rows, the first
+    // `count * frame_height` are filled. `tensor->number` and
+    // `tensor->timestamp_s` are of the first frame. nullptr when `count == 0`
+    FrameUP tensor;
+    std::size_t count;
+    int32_t frame_height;  // `VRImage::height` of each frame
+    std::vector<Frame::number_t> numbers;
+    std::vector<Frame::timestamp_s_t> timestamps_s;
+    // `Frame::extras` of each frame one after another (`count` msgpack lists)
+    std::vector<unsigned char> extras;
+  };
+
   /**
    * Main logging callback. Useful for debugging and to not flood stdout
    */
   using LogCallback =
       void (*)(char const* message, LogLevel log_level, void* userdata);
 
+  /**
+   * Thread safe allocator that keeps released frame buffers for reuse
+   * instead of freeing them. Sizes are rounded up to buckets at most 25%
+   * apart, at most `max_retained_bytes` are kept. Buffers are 64 byte
+   * aligned. With `huge_pages`, buffers of 2 MiB and more are backed by
+   * huge pages on Linux: reserved ones (MAP_HUGETLB) when available,
+   * transparent ones otherwise. The default allocator of `create` uses
+   * `shared()`.
+   *
+   * To use a separate pool, pass `allocate` and `deallocate` to `create`
+   * with the pool as `userdata`. The pool MUST outlive its frames
+   */
+  class BufferPool {
+  public:
+    static constexpr std::size_t DEFAULT_MAX_RETAINED_BYTES = 256 << 20;
+    explicit BufferPool(
+        std::size_t max_retained_bytes = DEFAULT_MAX_RETAINED_BYTES,
+        bool huge_pages = true);
+    ~BufferPool();
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator=(BufferPool const&) = delete;
+
+    uint8_t* acquire(std::size_t size);  // nullptr on failure
+    void release(uint8_t* data);  // `data` from `acquire` or nullptr
+    std::size_t retained_bytes() const;
+    void clear();  // frees retained buffers
+
+    // `AllocateCallback` and `DeallocateCallback`, `pool` is `BufferPool*`
+    static void allocate(VRImage* image, void* pool);
+    static void deallocate(VRImage* image, void* pool);
+
+    // process wide pool, never destroyed
+    static BufferPool& shared();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+  };
+
 public:
   // url: file path or any ffmpeg url
   // parameter_pairs: protocol parameters, for example:
@@ -83,6 +154,91 @@ public:
   //    "fflags", "+nobuffer +igndts", "rtbuffsize", "64738",
   //    "flags", "low_delay"}
   //
+  // additional ffmpeg reader parameters:
+  //   "index": "1" - build a packet index once and keep it next to the file
+  //                  as `<url>.vrindex`, "memory" - don't store the index,
+  //                  "<path>" - index sidecar path. Gives exact `size()` and
+  //                  keyframe targets for `seek`. Without a local file the
+  //                  sidecar is keyed on the size the protocol reports and
+  //                  the first packets, and isn't stored when the size is
+  //                  unknown
+  //   "segment_workers": "N" - decode N GOP segments of a seekable video in
+  //                  parallel, each with its own demuxer and decoder.
+  //                  Frames are still returned in order. Implies "index"
+  //   "output_format": "rgb24" (default), "bgr24", "rgba", "gray8",
+  //                  "yuv420p" or "nv12" - see `PIXEL_FORMAT`. Matching
+  //                  decoder planes (e.g. luma for "gray8") are copied
+  //                  without color conversion
+  //   "crop": "x,y,width,height" - region of decoded frames to convert
+  //   "output_width", "output_height": "N" - scale frames to this size in
+  //                  the same pass as color conversion. When only one is
+  //                  set, the other keeps the aspect ratio
+  //   "interpolation": "nearest", "fast_bilinear", "bilinear",
+  //                  "bicubic" (default), "area" or "lanczos"
+  //   "zero_copy": "1" - decode yuv420p/nv12 directly into `AllocateCallback`
+  //                  memory and return frames that match "output_format"
+  //                  without copying. Such frames are shared with the decoder
+  //                  (reference frames): they MUST NOT be modified, and
+  //                  `DeallocateCallback` is called when the decoder releases
+  //                  the memory, possibly with a larger `VRImage`.
+  //                  C++ API only
+  //   "read_queue_packets": "N" - demuxed packets to keep ahead of the
+  //                  decoder, 100 by default
+  //   "read_queue_bytes": "N" - the same limit in bytes, 64 MiB by default.
+  //                  Offline reading pauses when either limit is exceeded
+  //                  and resumes below 4/5 of both. Realtime streams skip
+  //                  to the newest queued keyframe instead, or drop packets
+  //                  up to the next keyframe. `Frame::number` counts
+  //                  dropped frames
+  //   "realtime": "1" - handle overflows like a realtime stream even when
+  //                  the input is seekable or custom, e.g. a live source
+  //                  behind `create_from_stream`. "0" - always pause.
+  //                  By default only non-seekable urls are realtime
+  //   "video_stream": "first" (default) - the first video stream, "best" -
+  //                  the one ffmpeg considers the main one, or "N" - stream
+  //                  index in the container. The demuxer discards packets
+  //                  of all other streams
+  //   "probe_cache": "<directory>" - keep codec parameters found by
+  //                  `avformat_find_stream_info` in this directory, and skip
+  //                  the probing next time the url is opened. Local files
+  //                  are probed again when their size or mtime changes
+  //   "probe_cache_key": "<key>" - cache entry name instead of the url,
+  //                  e.g. for cameras. Change the key when the stream
+  //                  settings (codec, resolution) change
+  //   "file_io": "ffmpeg" (default) - read local files with the ffmpeg file
+  //                  protocol, "mmap" - map the file to memory, "readahead"
+  //                  - read large chunks ahead on a separate thread, useful
+  //                  for network filesystems, "auto" - "readahead" on NFS,
+  //                  SMB, FUSE and similar, "mmap" on others and "ffmpeg"
+  //                  for non-file urls
+  //   "io_buffer_size": "N" - bytes read ahead with "readahead" (16 MiB by
+  //                  default), `AVIOContext` buffer size with "mmap"
+  //                  (64 KiB by default)
+  //   "read_thread": "0" - read packets in the thread that decodes them
+  //                  instead of a separate thread. For callers that
+  //                  schedule many readers on their own threads, see
+  //                  `VideoReaderGroup`. "read_queue_*" limits don't apply
+  //   "nonblocking": "1" - with "read_thread": "0", return no frame and set
+  //                  `would_block` instead of waiting for live input that
+  //                  has no data yet, for demuxers that support
+  //                  AVFMT_FLAG_NONBLOCK. Not with "decode_ahead" or
+  //                  "segment_workers"
+  //   "decode_ahead": "N" - decode and convert up to N frames on a separate
+  //                  thread while the caller processes previous frames.
+  //                  `next_frame(false)` returns converted frames too
+  //   "conversion_threads": "N" - split color conversion of each frame into
+  //                  horizontal bands converted by N threads
+  //   "alignment": "N" - `VRImage::stride` multiple, a power of two up to
+  //                  64, 16 by default. Also for galaxy and pylon cameras
+  //   "every_n": "N" - return only frames whose number is a multiple of N
+  //   "target_fps": "F" - return the first frame of every 1/F second.
+  //                  Other frames are neither converted nor allocated, and
+  //                  the decoder discards the non-reference ones.
+  //                  `Frame::number` is computed from the timestamp (exact
+  //                  with "index"). Not compatible with "segment_workers"
+  //   "keyframes_only": "1" - demux and decode keyframes only, e.g. for
+  //                  thumbnails. `Frame::number` is computed as above
+  //
   // see https://ffmpeg.org/ffmpeg-protocols.html for more details
   static std::unique_ptr<VideoReader> create(
       std::string const& url,
@@ -92,11 +248,49 @@ public:
       DeallocateCallback dealloc_callback = nullptr,
       LogCallback log_callback = nullptr,
       void* userdata = nullptr);
+
+  // like `create`, but demuxes `size` bytes at `data` with ffmpeg.
+  // The bytes are not copied and MUST outlive the reader
+  static std::unique_ptr<VideoReader> create_from_memory(
+      uint8_t const* data,
+      std::size_t size,
+      std::vector<std::string> const& parameter_pairs = {},
+      std::vector<std::string> const& extras = {},
+      AllocateCallback alloc_callback = nullptr,
+      DeallocateCallback dealloc_callback = nullptr,
+      LogCallback log_callback = nullptr,
+      void* userdata = nullptr);
+
+  /**
+   * Source of `create_from_stream`. The callbacks are called from
+   * the reading threads, one at a time
+   */
+  struct StreamCallbacks {
+    // copies up to `size` bytes to `buffer`, returns the number of bytes,
+    // 0 at the end of the stream or a negative value on error
+    int64_t (*read)(uint8_t* buffer, std::size_t size, void* opaque);
+    // moves to byte `position`, returns it or a negative value on error.
+    // nullptr when the stream isn't seekable
+    int64_t (*seek)(int64_t position, void* opaque);
+    int64_t size;  // stream size in bytes, -1 when unknown
+    void* opaque;
+  };
+
+  // like `create`, but demuxes bytes from `callbacks` with ffmpeg
+  static std::unique_ptr<VideoReader> create_from_stream(
+      StreamCallbacks const& callbacks,
+      std::vector<std::string> const& parameter_pairs = {},
+      std::vector<std::string> const& extras = {},
+      AllocateCallback alloc_callback = nullptr,
+      DeallocateCallback dealloc_callback = nullptr,
+      LogCallback log_callback = nullptr,
+      void* userdata = nullptr);
   virtual ~VideoReader();
 
   VideoReader& operator=(VideoReader const&) = delete;
 
-  // number of frames if known or 0 (see AVStream::nb_frames)
+  // number of frames if known or 0 (see AVStream::nb_frames).
+  // Exact for ffmpeg videos opened with {"index", ...} parameter
   virtual Frame::number_t size() const = 0;
 
   // see `parameter_pairs` from constructor
@@ -105,11 +299,39 @@ public:
   // offline video should be seekable, realtime not (see AVIOContext::seekable)
   virtual bool is_seekable() const = 0;
 
+  // seek to frame `number`, so that the next `next_frame` call returns it.
+  // Decoding starts from the nearest preceding keyframe
+  virtual void seek(Frame::number_t number);
+
+  // seek to the first frame with `Frame::timestamp_s` >= `timestamp_s`.
+  // Returns its number
+  virtual Frame::number_t seek_time(Frame::timestamp_s_t timestamp_s);
+
+  // continue with another video, as if the reader was created for `url`
+  // with the same options. Threads, buffers and the allocator are reused,
+  // and the decoder too when the codec parameters match, which makes
+  // processing many short clips cheaper. Throws and keeps reading the
+  // current video when `url` can't be opened
+  virtual void reopen(std::string const& url);
+
   // decode: decode the frame (false is useful for skipping frames,
-  //         the result will be a valid frame with uinitialized pixel values)
+  //         the result will be a valid frame with uinitialized pixel values.
+  //         The ffmpeg reader allocates no pixel memory then, and
+  //         `image.data` is nullptr)
   // frame data are read in a separate thread
   virtual FrameUP next_frame(bool decode = true) = 0;
 
+  // reads up to `n` frames with a single `AllocateCallback` call.
+  // The batch is shorter at the end of the video and when the frame
+  // size changes, `count == 0` means the end. With `decode == false`
+  // the ffmpeg reader leaves `tensor->image.data` nullptr
+  virtual Batch next_frames(std::size_t n, bool decode = true);
+
+  // the last `next_frame` or `next_frames` call returned no frame because
+  // "nonblocking" input had no data yet, not because the video ended.
+  // Try again later
+  virtual bool would_block() const;
+
   // `next_frame` method locks, but one can call `stop` from
   // another thread to request reading to terminate.
   // Automatically called from destructor
@@ -0,0 +1,57 @@
+#pragma once
+#include "videoreader.hpp"
+
+// Reads many videos (e.g. hundreds of cameras) with a fixed number of
+// threads. Every ffmpeg source is a `VideoReader` with, unless set,
+// "read_thread": "0", "nonblocking": "1" and ffmpeg "threads": "1".
+// Opening, demuxing, decoding and conversion of a source run as short
+// tasks on a work stealing pool, one frame per task, and the frames wait
+// in a queue per source. A live source without new data is retried a
+// few milliseconds later instead of holding a thread.
+//
+// When the queue of a seekable (offline) source is full, the source is
+// paused until a frame is taken. A non-seekable (realtime) source drops
+// its oldest queued frame instead.
+class VideoReaderGroup {
+public:
+  struct Source {
+    std::string url;
+    std::vector<std::string> parameter_pairs;  // see `VideoReader::create`
+    std::vector<std::string> extras;
+  };
+
+  // threads: pool size, 0 - `std::thread::hardware_concurrency()`
+  // queue_frames: decoded frames to keep per source
+  VideoReaderGroup(
+      std::vector<Source> const& sources,
+      std::size_t threads = 0,
+      std::size_t queue_frames = 4,
+      VideoReader::AllocateCallback alloc_callback = nullptr,
+      VideoReader::DeallocateCallback dealloc_callback = nullptr,
+      VideoReader::LogCallback log_callback = nullptr,
+      void* userdata = nullptr);
+  ~VideoReaderGroup();
+  VideoReaderGroup(VideoReaderGroup const&) = delete;
+  VideoReaderGroup& operator=(VideoReaderGroup const&) = delete;
+
+  std::size_t size() const;  // number of sources
+
+  // the oldest queued frame of any source, waits when there is none.
+  // `*source` is set to its index. nullptr when all sources ended or
+  // `stop` was called. Failed sources are logged and skipped
+  VideoReader::FrameUP next_frame_any(std::size_t* source);
+
+  // the next frame of `source`, nullptr at its end.
+  // Rethrows the error the source failed with
+  VideoReader::FrameUP next_frame(std::size_t source);
+
+  // frames a realtime source dropped because its queue was full
+  uint64_t dropped_frames(std::size_t source) const;
+
+  // can be called from any thread, makes waiting calls return
+  void stop();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include "videoreader.hpp"
+
+// Groups frames of several readers (e.g. cameras of a stereo rig) into
+// tuples with `Frame::timestamp_s` values at most `tolerance_s` apart.
+// Timestamps of all readers must share a clock.
+//
+// Every reader is read by its own thread into a queue of `buffer_frames`.
+// A tuple is built around the newest of the oldest queued frames: older
+// frames that can't be within tolerance of it are dropped, and of the
+// frames not newer than it, the newest one is taken. When a queue is full,
+// a seekable (offline) reader waits, a realtime one drops its oldest frame.
+class VideoReaderSync {
+public:
+  VideoReaderSync(
+      std::vector<std::unique_ptr<VideoReader>> readers,
+      double tolerance_s,
+      std::size_t buffer_frames = 8);
+  ~VideoReaderSync();
+  VideoReaderSync(VideoReaderSync const&) = delete;
+  VideoReaderSync& operator=(VideoReaderSync const&) = delete;
+
+  std::size_t size() const;  // number of readers
+
+  // the next tuple, `frames[idx]` is from reader `idx`. Waits for frames.
+  // Empty when a reader ended or after `stop`. Rethrows reader errors
+  std::vector<VideoReader::FrameUP> next_frames();
+
+  // frames of reader `idx` that didn't make it to a tuple
+  uint64_t dropped_frames(std::size_t idx) const;
+
+  // can be called from any thread, makes `next_frames` return
+  void stop();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
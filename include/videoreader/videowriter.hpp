@@ -7,7 +7,8 @@ public:
 
   // uri: path to a file
   // format: initial format for the data (should not be needed in the feature)
-  // parameter_pairs: codec parameters
+  // parameter_pairs: codec parameters and
+  //   "conversion_threads": "N" - convert RGB to YUV with N threads
   // realtime: when true, "push" sends frames to writing queue and exits
   // log_callback: log callback (currently unused)
   // userdata: data for log_callback (currently unused)
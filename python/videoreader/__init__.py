@@ -22,6 +22,14 @@ WARNING = 2
 INFO = 3
 DEBUG = 4
 
+# `VRImage.pixel_format`
+RGB24 = 0
+BGR24 = 1
+RGBA = 2
+GRAY8 = 3
+YUV420P = 4  # (height * 3 / 2, width) image, like in OpenCV
+NV12 = 5
+
 LogCallback: TypeAlias = Callable[[str, int], None] | None
 AllocCallback: TypeAlias = Callable[[CData, CData], None] | None
 
@@ -33,13 +41,16 @@ def raise_error() -> NoReturn:
 class VideoReaderBase:
     def __init__(
         self,
-        path: str | Path,
+        path: str | Path | bytes,
         arguments: list[str] = [],
         extras: list[str] = [],
         alloc_callback: AllocCallback = ffi.NULL,
         free_callback: AllocCallback = ffi.NULL,
         log_callback: LogCallback = None,
     ):
+        """
+        path: file path, ffmpeg url or the video itself as `bytes`
+        """
         handler = ffi.new("struct videoreader **")
         self.log_callback = log_callback
         self.frame_idx = 0
@@ -48,8 +59,23 @@ class VideoReaderBase:
         extras_keepalive = [ffi.new("char[]", arg.encode()) for arg in extras]
         self._self_handle = ffi.new_handle(self)
 
-        if (
-            backend.videoreader_create(
+        if isinstance(path, bytes):
+            self._data = path  # the reader doesn't copy the bytes
+            ret = backend.videoreader_create_from_memory(
+                handler,
+                ffi.from_buffer("uint8_t[]", path),
+                len(path),
+                argv_keepalive,
+                len(argv_keepalive),
+                extras_keepalive,
+                len(extras_keepalive),
+                alloc_callback,
+                free_callback,
+                videoreader_log if log_callback else ffi.NULL,
+                self._self_handle,
+            )
+        else:
+            ret = backend.videoreader_create(
                 handler,
                 str(path).encode("utf-8"),
                 argv_keepalive,
@@ -61,8 +87,7 @@ class VideoReaderBase:
                 videoreader_log if log_callback else ffi.NULL,
                 self._self_handle,
             )
-            != 0
-        ):
+        if ret != 0:
             raise_error()
         self._handler = ffi.gc(handler[0], backend.videoreader_delete)
 
@@ -102,17 +127,95 @@ class VideoReaderBase:
             else:
                 raise_error()
 
+    def _iter_batches(
+        self, n: int, decode: bool = True
+    ) -> "Iterator[tuple[CData, int, int, *tuple[list, ...]]]":
+        """
+        Yields `(image, count, frame_height, numbers, timestamps[, extras])`
+        where `image` holds `n` frames, of which the first `count` are read
+        """
+        count = ffi.new("uint64_t *")
+        frame_height = ffi.new("int32_t *")
+        numbers = ffi.new("uint64_t[]", n)
+        timestamps = ffi.new("double[]", n)
+        extras_p = ffi.new("unsigned char **")
+        extras_size = ffi.new("unsigned int *")
+        while True:
+            image = ffi.new("VRImage *")
+            ret = backend.videoreader_next_frames(
+                self._handler,
+                n,
+                image,
+                count,
+                frame_height,
+                numbers,
+                timestamps,
+                extras_p,
+                extras_size,
+                decode,
+            )
+            if ret == 0:
+                n_read = count[0]
+                self.frame_idx += n_read
+                batch = (
+                    image,
+                    n_read,
+                    frame_height[0],
+                    numbers[0:n_read],
+                    timestamps[0:n_read],
+                )
+                extras = extras_p[0]
+                if extras == ffi.NULL:
+                    yield batch
+                else:
+                    try:
+                        from msgpack import Unpacker
+
+                        unpacker = Unpacker()
+                        unpacker.feed(ffi.buffer(extras, extras_size[0]))
+                        info = list(unpacker)
+                    finally:
+                        backend.free(extras)
+                    yield (*batch, info)
+            elif ret == 1:  # no more frames
+                return
+            else:
+                raise_error()
+
     def iter_fast(self):
         return self.__iter__(decode=False)
 
     def seek(self, seek_idx: int) -> None:
-        if self.frame_idx == seek_idx:
-            return
-        for _ in self.iter_fast():
-            if self.frame_idx == seek_idx:
-                break
-        if self.frame_idx != seek_idx:
-            raise ValueError(f"No frame with index `{seek_idx}` was found.")
+        """
+        Seek to frame number `seek_idx`. Decoding starts from the nearest
+        preceding keyframe, so the cost doesn't depend on the distance
+        """
+        if backend.videoreader_seek(self._handler, seek_idx) != 0:
+            raise_error()
+        self.frame_idx = seek_idx
+
+    def seek_time(self, timestamp: float) -> None:
+        """
+        Seek to the first frame with timestamp >= `timestamp` seconds
+        """
+        number = ffi.new("uint64_t *")
+        if (
+            backend.videoreader_seek_time(self._handler, timestamp, number)
+            != 0
+        ):
+            raise_error()
+        self.frame_idx = number[0]
+
+    def reopen(self, path: str | Path) -> None:
+        """
+        Continue with another video, reusing threads, buffers and,
+        when the codec parameters match, the decoder
+        """
+        if backend.videoreader_reopen(
+            self._handler, str(path).encode("utf-8")
+        ):
+            raise_error()
+        self.frame_idx = 0
 
     def seek_get_img(self, seek_idx: int) -> T | None:
         self.seek(seek_idx)
@@ -31,7 +31,7 @@ def free_callback_callback_numpy(image: CData, self: CData) -> None:
 class VideoReaderMinImg(VideoReaderBase[MinImg]):
     def __init__(
         self,
-        path: str,
+        path: str | bytes,
         arguments: list[str] = [],
         extras: list[str] = [],
         log_callback: LogCallback = None,
@@ -47,9 +47,15 @@ class VideoReaderMinImg(VideoReaderBase[MinImg]):
         )
 
     def __iter__(
-        self,
-    ) -> "Iterator[tuple[CData, *tuple[int | float, ...]]]":
-        for image, *other in super().__iter__():
+        self, decode: bool = True
+    ) -> "Iterator[tuple[CData | None, *tuple[int | float, ...]]]":
+        """
+        with `decode=False` the image is None, no pixel memory is allocated
+        """
+        for image, *other in self._iter(decode):
+            if image.data == ffi.NULL:
+                yield (None, *other)
+                continue
             address = int(ffi.cast("uintptr_t", image.data))
             yield (self.memory.pop(address), *other)
 
@@ -3,25 +3,91 @@ from typing import TypeAlias, Any
 import numpy as np
 from . import VideoReaderBase, VideoWriterBase, ffi, LogCallback, CData
 from collections.abc import Iterator
+from threading import RLock
+import weakref
 
 
 Image: TypeAlias = np.ndarray[Any, np.dtype[np.uint8]]
 
 
+class _Lease:
+    """
+    Exposes a pooled array. Every view of the handed out array has the lease
+    as its base, so the lease dies with the last of them
+    """
+
+    def __init__(self, array: Image) -> None:
+        self.array = array
+        self.__array_interface__ = array.__array_interface__
+
+
+class NumpyBufferPool:
+    """
+    Hands out frame arrays that nothing references anymore instead of
+    allocating new ones. At most `max_bytes` of arrays are kept.
+    Can be shared between readers
+    """
+
+    def __init__(self, max_bytes: int = 256 << 20) -> None:
+        self.max_bytes = max_bytes
+        self._free: dict[tuple[int, ...], list[Image]] = {}
+        self._bytes = 0  # of the arrays owned by the pool, free or handed out
+        self._generation = 0  # arrays handed out before `clear` aren't kept
+        # callbacks can come from decoding threads, and finalizers
+        # can run in a thread holding the lock
+        self._lock = RLock()
+
+    def _release(self, array: Image, generation: int) -> None:
+        with self._lock:
+            if generation == self._generation:
+                self._free.setdefault(array.shape, []).append(array)
+
+    def empty(self, shape: tuple[int, ...]) -> Image:
+        with self._lock:
+            free = self._free.get(shape)
+            if free:
+                array = free.pop()
+            else:
+                array = np.empty(shape, dtype=np.uint8)
+                if self._bytes + array.nbytes > self.max_bytes:
+                    return array
+                self._bytes += array.nbytes
+            generation = self._generation
+        lease = _Lease(array)
+        weakref.finalize(lease, self._release, array, generation)
+        return np.asarray(lease)
+
+    def clear(self) -> None:
+        with self._lock:
+            self._free.clear()
+            self._bytes = 0
+            self._generation += 1
+
+
 @ffi.callback("void (VRImage*, void*)")
 def alloc_callback_numpy(image: CData, self: CData) -> None:
     assert image.scalar_type == 0, f"non uint8 images not yet supported"
     assert image.channels >= 1
-    arr = np.empty((image.height, image.width, image.channels), dtype=np.uint8)
-    ai = arr.__array_interface__
-    address = ai["data"][0]
-    assert (
-        ai["strides"] is None
-    ), f"{image.height}x{image.width}x{image.channels} images not yet supported"
-    assert (
-        image.stride == arr.dtype.itemsize * image.width * image.channels
-    ), "unsupported image"
-    memory = ffi.from_handle(self).memory
+    reader = ffi.from_handle(self)
+    height, width, channels = image.height, image.width, image.channels
+    row_bytes = width * channels
+    stride = image.stride or row_bytes
+    assert stride >= row_bytes, "unsupported image"
+    # rows padded for "alignment" are viewed without the padding
+    shape = (
+        (height, width, channels) if stride == row_bytes else (height, stride)
+    )
+    if reader.pool is not None:
+        buffer = reader.pool.empty(shape)
+    else:
+        buffer = np.empty(shape, dtype=np.uint8)
+    if stride == row_bytes:
+        arr = buffer
+    else:
+        arr = buffer[:, :row_bytes].reshape(height, width, channels)
+    address = buffer.__array_interface__["data"][0]
+    image.stride = stride
+    memory = reader.memory
     image.data = ffi.cast("uint8_t *", address)
     image.user_data = ffi.NULL
     assert address not in memory, "programmer error"
@@ -37,12 +103,52 @@ def free_callback_callback_numpy(image: CData, self: CData) -> None:
 class VideoReaderNumpy(VideoReaderBase):
     def __init__(
         self,
-        path: str,
+        path: str | bytes,
         arguments: list[str] = [],
         extras: list[str] = [],
         log_callback: LogCallback = None,
+        *,
+        output_width: int | None = None,
+        output_height: int | None = None,
+        interpolation: str | None = None,
+        crop: tuple[int, int, int, int] | None = None,
+        every_n: int | None = None,
+        target_fps: float | None = None,
+        keyframes_only: bool = False,
+        pool: NumpyBufferPool | None = None,
+        alignment: int | None = None,
     ) -> None:
+        """
+        output_width, output_height: scale frames, when only one is set,
+          the other keeps the aspect ratio
+        interpolation: "nearest", "fast_bilinear", "bilinear", "bicubic",
+          "area" or "lanczos"
+        crop: (x, y, width, height) region of the source frame
+        every_n: return only frames whose number is a multiple of `every_n`
+        target_fps: return the first frame of every 1/`target_fps` second
+        keyframes_only: demux and decode keyframes only
+        pool: reuse frame arrays once nothing references them
+        alignment: row stride multiple in bytes, a power of two up to 64
+        """
         self.memory: dict[int, Image] = {}
+        self.pool = pool
+        arguments = list(arguments)
+        if output_width is not None:
+            arguments += ["output_width", str(output_width)]
+        if output_height is not None:
+            arguments += ["output_height", str(output_height)]
+        if interpolation is not None:
+            arguments += ["interpolation", interpolation]
+        if crop is not None:
+            arguments += ["crop", ",".join(str(value) for value in crop)]
+        if every_n is not None:
+            arguments += ["every_n", str(every_n)]
+        if target_fps is not None:
+            arguments += ["target_fps", repr(float(target_fps))]
+        if keyframes_only:
+            arguments += ["keyframes_only", "1"]
+        if alignment is not None:
+            arguments += ["alignment", str(alignment)]
         super().__init__(
             path,
             arguments,
@@ -52,11 +158,44 @@ class VideoReaderNumpy(VideoReaderBase):
             log_callback,
         )
 
-    def __iter__(self) -> "Iterator[tuple[Image, *tuple[int | float, ...]]]":
-        for image, *other in self._iter():
+    def __iter__(
+        self, decode: bool = True
+    ) -> "Iterator[tuple[Image | None, *tuple[int | float, ...]]]":
+        """
+        with `decode=False` the image is None, no pixel memory is allocated
+        """
+        for image, *other in self._iter(decode):
+            if image.data == ffi.NULL:
+                yield (None, *other)
+                continue
             address = int(ffi.cast("uintptr_t", image.data))
             yield (self.memory.pop(address), *other)
 
+    def iter_batches(
+        self, n: int
+    ) -> "Iterator[tuple[Image, list[int], list[float], *tuple[list, ...]]]":
+        """
+        Yields `(frames, numbers, timestamps[, extras])` where `frames` is
+        a `(count, height, width, channels)` array, `count <= n`. It is a
+        view of the batch allocation, not a copy, even with "alignment"
+        """
+        for image, count, frame_height, *other in self._iter_batches(n):
+            address = int(ffi.cast("uintptr_t", image.data))
+            tensor = self.memory.pop(address)
+            # a view over the allocation, also when rows are padded
+            row_stride, pixel_stride, channel_stride = tensor.strides
+            frames = np.lib.stride_tricks.as_strided(
+                tensor,
+                shape=(count, frame_height, image.width, image.channels),
+                strides=(
+                    frame_height * row_stride,
+                    row_stride,
+                    pixel_stride,
+                    channel_stride,
+                ),
+            )
+            yield (frames, *other)
+
     def __del__(self) -> None:
         if self.memory:
             print(f"{len(self.memory)} items were left allocated in {self}")
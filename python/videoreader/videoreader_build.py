@@ -17,6 +17,7 @@ typedef struct {
   int32_t stride;
   uint8_t *data;
   void *user_data;
+  int32_t pixel_format;
 } VRImage;
 typedef void (*videoreader_log_t)(char const*, int, void*);
 typedef void (*videoreader_alloc_t)(VRImage*,void*);
@@ -33,6 +34,19 @@ int videoreader_create(
     videoreader_log_t callback,
     void* userdata);
 
+int videoreader_create_from_memory(
+    struct videoreader**,
+    uint8_t const* data,
+    uint64_t size,
+    char const* argv[],
+    int argc,
+    char const* extras[],
+    int extrasc,
+    videoreader_alloc_t alloc_callback,
+    videoreader_alloc_t free_callback,
+    videoreader_log_t callback,
+    void* userdata);
+
 char const* videoreader_what(void);
 
 void videoreader_delete(struct videoreader*);
@@ -46,6 +60,18 @@ int videoreader_next_frame(
     unsigned int* extras_size,
     bool decode);
 
+int videoreader_next_frames(
+    struct videoreader*,
+    uint64_t n,
+    VRImage* dst_img,
+    uint64_t* count,
+    int32_t* frame_height,
+    uint64_t* numbers,
+    double* timestamps_s,
+    unsigned char* extras[],
+    unsigned int* extras_size,
+    bool decode);
+
 int videoreader_set(
     struct videoreader*,
     char const* argv[],
@@ -54,6 +80,15 @@ int videoreader_set(
 
 int videoreader_stop(struct videoreader*);
 
+int videoreader_seek(struct videoreader*, uint64_t number);
+
+int videoreader_seek_time(
+    struct videoreader*,
+    double timestamp_s,
+    uint64_t* number
+);
+int videoreader_reopen(struct videoreader*, char const* url);
+
 int videoreader_size(struct videoreader*, uint64_t* count);
 
 // writer
@@ -0,0 +1,200 @@
+#include <mutex>
+#include <new>  // std::align_val_t
+#include <unordered_map>
+#include <vector>
+#include <videoreader/videoreader.hpp>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// aligned for SIMD and for decoding directly into the image ("zero_copy")
+static std::align_val_t const BUFFER_ALIGNMENT{64};
+
+static std::size_t const HUGE_PAGE_SIZE = std::size_t{2} << 20;
+
+// precedes every buffer, so `release` doesn't depend on the image size
+struct alignas(64) BufferHeader {
+  std::size_t bucket;  // usable bytes after the header
+  std::size_t mapped;  // `mmap` length, 0 for `operator new` memory
+};
+
+// `size` rounded up to a quarter of its highest power of two, or so that
+// the buffer with its header takes whole huge pages
+static std::size_t _bucket_size(std::size_t size, bool huge_pages) {
+  if (huge_pages && size >= HUGE_PAGE_SIZE) {
+    std::size_t const pages =
+        (sizeof(BufferHeader) + size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE;
+    return pages * HUGE_PAGE_SIZE - sizeof(BufferHeader);
+  }
+  std::size_t const MIN_BUCKET = 4096;
+  if (size <= MIN_BUCKET) {
+    return MIN_BUCKET;
+  }
+  std::size_t power = MIN_BUCKET;
+  while (power <= size / 2) {
+    power *= 2;
+  }
+  std::size_t const step = power / 4;
+  return (size + step - 1) / step * step;
+}
+
+#ifdef __linux__
+static void* _map_huge_pages(std::size_t length) {
+#ifdef MAP_HUGETLB
+  void* const reserved = mmap(
+      nullptr,
+      length,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+      -1,
+      0);
+  if (reserved != MAP_FAILED) {
+    return reserved;
+  }
+#endif
+  // no reserved huge pages, map an aligned range for transparent ones
+  void* const memory = mmap(
+      nullptr,
+      length + HUGE_PAGE_SIZE,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  uintptr_t const begin = reinterpret_cast<uintptr_t>(memory);
+  uintptr_t const aligned =
+      (begin + HUGE_PAGE_SIZE - 1) & ~(uintptr_t{HUGE_PAGE_SIZE} - 1);
+  if (aligned != begin) {
+    munmap(memory, aligned - begin);
+  }
+  std::size_t const tail = HUGE_PAGE_SIZE - (aligned - begin);
+  if (tail != 0) {
+    munmap(reinterpret_cast<void*>(aligned + length), tail);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(reinterpret_cast<void*>(aligned), length, MADV_HUGEPAGE);
+#endif
+  return reinterpret_cast<void*>(aligned);
+}
+#endif
+
+static BufferHeader* _allocate_buffer(std::size_t bucket, bool huge_pages) {
+  std::size_t const size = sizeof(BufferHeader) + bucket;
+#ifdef __linux__
+  if (huge_pages && size % HUGE_PAGE_SIZE == 0) {
+    if (void* const memory = _map_huge_pages(size)) {
+      return new (memory) BufferHeader{bucket, size};
+    }
+  }
+#endif
+  void* const memory = ::operator new[](size, BUFFER_ALIGNMENT, std::nothrow);
+  return memory ? new (memory) BufferHeader{bucket, 0} : nullptr;
+}
+
+static void _free_buffer(BufferHeader* header) {
+#ifdef __linux__
+  if (header->mapped) {
+    munmap(header, header->mapped);
+    return;
+  }
+#endif
+  ::operator delete[](header, BUFFER_ALIGNMENT);
+}
+
+struct VideoReader::BufferPool::Impl {
+  std::size_t const max_retained_bytes;
+  bool const huge_pages;
+  mutable std::mutex mutex;  // guards everything below
+  std::size_t retained_bytes = 0;
+  std::unordered_map<std::size_t, std::vector<BufferHeader*>> free_buffers;
+
+  Impl(std::size_t max_retained_bytes, bool huge_pages) :
+      max_retained_bytes{max_retained_bytes},
+      huge_pages{huge_pages} {
+  }
+};
+
+VideoReader::BufferPool::BufferPool(
+    std::size_t max_retained_bytes, bool huge_pages) :
+    impl{new Impl(max_retained_bytes, huge_pages)} {
+}
+
+VideoReader::BufferPool::~BufferPool() {
+  this->clear();
+}
+
+uint8_t* VideoReader::BufferPool::acquire(std::size_t size) {
+  std::size_t const bucket = _bucket_size(size, this->impl->huge_pages);
+  BufferHeader* header = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(this->impl->mutex);
+    auto it = this->impl->free_buffers.find(bucket);
+    if (it != this->impl->free_buffers.end() && !it->second.empty()) {
+      header = it->second.back();
+      it->second.pop_back();
+      this->impl->retained_bytes -= bucket;
+    }
+  }
+  if (!header) {
+    header = _allocate_buffer(bucket, this->impl->huge_pages);
+    if (!header) {
+      return nullptr;
+    }
+  }
+  return reinterpret_cast<uint8_t*>(header + 1);
+}
+
+void VideoReader::BufferPool::release(uint8_t* data) {
+  if (!data) {
+    return;
+  }
+  BufferHeader* const header = reinterpret_cast<BufferHeader*>(data) - 1;
+  {
+    std::lock_guard<std::mutex> guard(this->impl->mutex);
+    if (this->impl->retained_bytes + header->bucket <=
+        this->impl->max_retained_bytes) {
+      this->impl->free_buffers[header->bucket].push_back(header);
+      this->impl->retained_bytes += header->bucket;
+      return;
+    }
+  }
+  _free_buffer(header);
+}
+
+std::size_t VideoReader::BufferPool::retained_bytes() const {
+  std::lock_guard<std::mutex> guard(this->impl->mutex);
+  return this->impl->retained_bytes;
+}
+
+void VideoReader::BufferPool::clear() {
+  std::unordered_map<std::size_t, std::vector<BufferHeader*>> free_buffers;
+  {
+    std::lock_guard<std::mutex> guard(this->impl->mutex);
+    free_buffers.swap(this->impl->free_buffers);
+    this->impl->retained_bytes = 0;
+  }
+  for (auto& bucket_buffers : free_buffers) {
+    for (BufferHeader* header : bucket_buffers.second) {
+      _free_buffer(header);
+    }
+  }
+}
+
+void VideoReader::BufferPool::allocate(VRImage* image, void* pool) {
+  std::size_t const size =
+      static_cast<std::size_t>(image->stride) * image->height;
+  image->data = static_cast<BufferPool*>(pool)->acquire(size);
+}
+
+void VideoReader::BufferPool::deallocate(VRImage* image, void* pool) {
+  static_cast<BufferPool*>(pool)->release(image->data);
+  image->data = nullptr;
+}
+
+VideoReader::BufferPool& VideoReader::BufferPool::shared() {
+  // leaked, so that frames can outlive static destructors
+  static BufferPool* const pool = new BufferPool();
+  return *pool;
+}
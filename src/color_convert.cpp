@@ -0,0 +1,680 @@
+#include "color_convert.hpp"
+#include <stdexcept>  // std::runtime_error
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#define VR_COLOR_CONVERT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>  // __cpuid
+#endif
+#endif
+
+// MSVC compiles intrinsics of any instruction set without flags
+#ifdef __GNUC__
+#define VR_TARGET(isa) __attribute__((target(isa)))
+#else
+#define VR_TARGET(isa)
+#endif
+
+//
+// Scalar implementation is the reference: SIMD versions do exactly the same
+// integer operations. Coefficients have 8 fractional bits.
+//
+
+static inline uint8_t _clamp_u8(int value) {
+  return static_cast<uint8_t>(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+static inline int _rgb_to_y(int r, int g, int b) {
+  return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline int _rgb_to_u(int r, int g, int b) {
+  return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline int _rgb_to_v(int r, int g, int b) {
+  return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+// converts columns [x_begin, width) of a row. `x_begin` is even
+static void _yuv420_to_rgb24_row_scalar(
+    uint8_t const* y_row,
+    uint8_t const* u_row,
+    uint8_t const* v_row,
+    int uv_step,
+    uint8_t* dst_row,
+    int x_begin,
+    int width) {
+  for (int x = x_begin; x < width; ++x) {
+    int const uv_idx = (x >> 1) * uv_step;
+    int const c = (y_row[x] - 16) * 298;
+    int const d = u_row[uv_idx] - 128;
+    int const e = v_row[uv_idx] - 128;
+    uint8_t* const rgb = dst_row + x * 3;
+    rgb[0] = _clamp_u8((c + 409 * e + 128) >> 8);
+    rgb[1] = _clamp_u8((c - 100 * d - 208 * e + 128) >> 8);
+    rgb[2] = _clamp_u8((c + 516 * d + 128) >> 8);
+  }
+}
+
+// converts columns [x_begin, width) of a row pair. `x_begin` is even.
+// `row1` is nullptr for the last row of odd height images
+static void _rgb24_to_yuv420_rows_scalar(
+    uint8_t const* row0,
+    uint8_t const* row1,
+    uint8_t* y_row0,
+    uint8_t* y_row1,
+    uint8_t* u_row,
+    uint8_t* v_row,
+    int uv_step,
+    int x_begin,
+    int width) {
+  for (int x = x_begin; x < width; x += 2) {
+    int sum_r = 0, sum_g = 0, sum_b = 0, count = 0;
+    for (int row_idx = 0; row_idx < 2; ++row_idx) {
+      uint8_t const* const row = row_idx == 0 ? row0 : row1;
+      uint8_t* const y_row = row_idx == 0 ? y_row0 : y_row1;
+      if (!row) {
+        break;
+      }
+      for (int col = x; col < x + 2 && col < width; ++col) {
+        uint8_t const* const rgb = row + col * 3;
+        y_row[col] = static_cast<uint8_t>(_rgb_to_y(rgb[0], rgb[1], rgb[2]));
+        sum_r += rgb[0];
+        sum_g += rgb[1];
+        sum_b += rgb[2];
+        ++count;
+      }
+    }
+    int const r = (sum_r + count / 2) / count;
+    int const g = (sum_g + count / 2) / count;
+    int const b = (sum_b + count / 2) / count;
+    int const uv_idx = (x >> 1) * uv_step;
+    u_row[uv_idx] = static_cast<uint8_t>(_rgb_to_u(r, g, b));
+    v_row[uv_idx] = static_cast<uint8_t>(_rgb_to_v(r, g, b));
+  }
+}
+
+static void _yuv420_to_rgb24_scalar(
+    YUV420Planes const& src,
+    uint8_t* dst,
+    int dst_stride,
+    int width,
+    int height) {
+  for (int row = 0; row < height; ++row) {
+    int const uv_offset = (row >> 1) * src.uv_stride;
+    _yuv420_to_rgb24_row_scalar(
+        src.y + row * src.y_stride,
+        src.u + uv_offset,
+        src.v + uv_offset,
+        src.uv_step,
+        dst + row * dst_stride,
+        0,
+        width);
+  }
+}
+
+static void _rgb24_to_yuv420_scalar(
+    uint8_t const* src,
+    int src_stride,
+    YUV420Planes const& dst,
+    int width,
+    int height) {
+  for (int row = 0; row < height; row += 2) {
+    bool const has_pair = row + 1 < height;
+    int const uv_offset = (row >> 1) * dst.uv_stride;
+    _rgb24_to_yuv420_rows_scalar(
+        src + row * src_stride,
+        has_pair ? src + (row + 1) * src_stride : nullptr,
+        dst.y + row * dst.y_stride,
+        has_pair ? dst.y + (row + 1) * dst.y_stride : nullptr,
+        dst.u + uv_offset,
+        dst.v + uv_offset,
+        dst.uv_step,
+        0,
+        width);
+  }
+}
+
+#ifdef VR_COLOR_CONVERT_X86
+
+// `pshufb` masks between 16 R, G and B bytes and 48 RGB24 bytes
+struct RGBShuffle {
+  __m128i masks[3][3];  // [16 byte block of RGB24][channel]
+};
+
+VR_TARGET("sse4.1")
+static RGBShuffle _rgb_shuffle(bool interleave) {
+  RGBShuffle shuffle;
+  for (int block = 0; block < 3; ++block) {
+    for (int channel = 0; channel < 3; ++channel) {
+      alignas(16) int8_t mask[16];
+      for (int idx = 0; idx < 16; ++idx) {
+        int const pos = interleave ? block * 16 + idx  // byte in RGB24
+                                   : idx * 3 + channel - block * 16;
+        if (interleave) {
+          mask[idx] = static_cast<int8_t>(pos % 3 == channel ? pos / 3 : -128);
+        } else {
+          mask[idx] = static_cast<int8_t>(pos >= 0 && pos < 16 ? pos : -128);
+        }
+      }
+      shuffle.masks[block][channel] =
+          _mm_load_si128(reinterpret_cast<__m128i const*>(mask));
+    }
+  }
+  return shuffle;
+}
+
+VR_TARGET("sse4.1")
+static inline void _store_rgb24(
+    uint8_t* dst,
+    __m128i r,
+    __m128i g,
+    __m128i b,
+    RGBShuffle const& shuffle) {
+  for (int block = 0; block < 3; ++block) {
+    __m128i const* const masks = shuffle.masks[block];
+    __m128i const rgb = _mm_or_si128(
+        _mm_or_si128(
+            _mm_shuffle_epi8(r, masks[0]), _mm_shuffle_epi8(g, masks[1])),
+        _mm_shuffle_epi8(b, masks[2]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + block * 16), rgb);
+  }
+}
+
+VR_TARGET("sse4.1")
+static inline void _load_rgb24(
+    uint8_t const* src,
+    __m128i* r,
+    __m128i* g,
+    __m128i* b,
+    RGBShuffle const& shuffle) {
+  __m128i blocks[3];
+  for (int block = 0; block < 3; ++block) {
+    blocks[block] =
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + block * 16));
+  }
+  __m128i* const channels[3] = {r, g, b};
+  for (int channel = 0; channel < 3; ++channel) {
+    *channels[channel] = _mm_or_si128(
+        _mm_or_si128(
+            _mm_shuffle_epi8(blocks[0], shuffle.masks[0][channel]),
+            _mm_shuffle_epi8(blocks[1], shuffle.masks[1][channel])),
+        _mm_shuffle_epi8(blocks[2], shuffle.masks[2][channel]));
+  }
+}
+
+// 16 bytes -> 4 x 4 int32
+VR_TARGET("sse4.1")
+static inline void _widen_u8(__m128i bytes, __m128i out[4]) {
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const lo = _mm_unpacklo_epi8(bytes, zero);
+  __m128i const hi = _mm_unpackhi_epi8(bytes, zero);
+  out[0] = _mm_unpacklo_epi16(lo, zero);
+  out[1] = _mm_unpackhi_epi16(lo, zero);
+  out[2] = _mm_unpacklo_epi16(hi, zero);
+  out[3] = _mm_unpackhi_epi16(hi, zero);
+}
+
+// 4 x 4 int32 -> 16 saturated bytes
+VR_TARGET("sse4.1")
+static inline __m128i _narrow_u8(__m128i const in[4]) {
+  return _mm_packus_epi16(
+      _mm_packs_epi32(in[0], in[1]), _mm_packs_epi32(in[2], in[3]));
+}
+
+// loads 8 chroma samples and duplicates them horizontally
+VR_TARGET("sse4.1")
+static inline void _load_chroma(
+    uint8_t const* u_row,
+    uint8_t const* v_row,
+    int uv_step,
+    int x,
+    __m128i* u,
+    __m128i* v) {
+  if (uv_step == 1) {
+    *u = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(u_row + x / 2));
+    *v = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(v_row + x / 2));
+  } else {
+    __m128i const uv =
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(u_row + x));
+    __m128i const even = _mm_setr_epi8(
+        0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i const odd = _mm_setr_epi8(
+        1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+    *u = _mm_shuffle_epi8(uv, even);
+    *v = _mm_shuffle_epi8(uv, odd);
+  }
+  *u = _mm_unpacklo_epi8(*u, *u);
+  *v = _mm_unpacklo_epi8(*v, *v);
+}
+
+// 8 chroma samples, `u` and `v` are 8 bytes
+VR_TARGET("sse4.1")
+static inline void _store_chroma(
+    uint8_t* u_row, uint8_t* v_row, int uv_step, int x, __m128i u, __m128i v) {
+  if (uv_step == 1) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(u_row + x / 2), u);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(v_row + x / 2), v);
+  } else {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(u_row + x), _mm_unpacklo_epi8(u, v));
+  }
+}
+
+// averages of 8 2x2 blocks of 16 pixel row pair, as 2 x 4 int32
+VR_TARGET("sse4.1")
+static inline void
+_block_average(__m128i row0, __m128i row1, __m128i* lo, __m128i* hi) {
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const ones = _mm_set1_epi16(1);
+  __m128i const two = _mm_set1_epi32(2);
+  __m128i const sum_lo = _mm_add_epi16(
+      _mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));
+  __m128i const sum_hi = _mm_add_epi16(
+      _mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+  *lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(sum_lo, ones), two), 2);
+  *hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(sum_hi, ones), two), 2);
+}
+
+// ((kr * r + kg * g + kb * b + 128) >> 8) + offset
+VR_TARGET("sse4.1")
+static inline __m128i _dot_sse41(
+    __m128i r, __m128i g, __m128i b, int kr, int kg, int kb, int offset) {
+  __m128i sum = _mm_add_epi32(
+      _mm_add_epi32(
+          _mm_mullo_epi32(r, _mm_set1_epi32(kr)),
+          _mm_mullo_epi32(g, _mm_set1_epi32(kg))),
+      _mm_mullo_epi32(b, _mm_set1_epi32(kb)));
+  sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+  return _mm_add_epi32(sum, _mm_set1_epi32(offset));
+}
+
+VR_TARGET("sse4.1")
+static inline __m128i _rgb_to_y_sse41(__m128i r, __m128i g, __m128i b) {
+  __m128i r32[4], g32[4], b32[4], y32[4];
+  _widen_u8(r, r32);
+  _widen_u8(g, g32);
+  _widen_u8(b, b32);
+  for (int group = 0; group < 4; ++group) {
+    y32[group] =
+        _dot_sse41(r32[group], g32[group], b32[group], 66, 129, 25, 16);
+  }
+  return _narrow_u8(y32);
+}
+
+VR_TARGET("sse4.1")
+static void _yuv420_to_rgb24_sse41(
+    YUV420Planes const& src,
+    uint8_t* dst,
+    int dst_stride,
+    int width,
+    int height) {
+  RGBShuffle const shuffle = _rgb_shuffle(true);
+  __m128i const k16 = _mm_set1_epi32(16);
+  __m128i const k128 = _mm_set1_epi32(128);
+  for (int row = 0; row < height; ++row) {
+    uint8_t const* const y_row = src.y + row * src.y_stride;
+    uint8_t const* const u_row = src.u + (row >> 1) * src.uv_stride;
+    uint8_t const* const v_row = src.v + (row >> 1) * src.uv_stride;
+    uint8_t* const dst_row = dst + row * dst_stride;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i u, v;
+      _load_chroma(u_row, v_row, src.uv_step, x, &u, &v);
+      __m128i y32[4], u32[4], v32[4], r32[4], g32[4], b32[4];
+      _widen_u8(
+          _mm_loadu_si128(reinterpret_cast<__m128i const*>(y_row + x)), y32);
+      _widen_u8(u, u32);
+      _widen_u8(v, v32);
+      for (int group = 0; group < 4; ++group) {
+        __m128i const c = _mm_mullo_epi32(
+            _mm_sub_epi32(y32[group], k16), _mm_set1_epi32(298));
+        __m128i const d = _mm_sub_epi32(u32[group], k128);
+        __m128i const e = _mm_sub_epi32(v32[group], k128);
+        __m128i const c_round = _mm_add_epi32(c, k128);
+        r32[group] = _mm_srai_epi32(
+            _mm_add_epi32(c_round, _mm_mullo_epi32(e, _mm_set1_epi32(409))),
+            8);
+        g32[group] = _mm_srai_epi32(
+            _mm_sub_epi32(
+                _mm_sub_epi32(
+                    c_round, _mm_mullo_epi32(d, _mm_set1_epi32(100))),
+                _mm_mullo_epi32(e, _mm_set1_epi32(208))),
+            8);
+        b32[group] = _mm_srai_epi32(
+            _mm_add_epi32(c_round, _mm_mullo_epi32(d, _mm_set1_epi32(516))),
+            8);
+      }
+      _store_rgb24(
+          dst_row + x * 3,
+          _narrow_u8(r32),
+          _narrow_u8(g32),
+          _narrow_u8(b32),
+          shuffle);
+    }
+    _yuv420_to_rgb24_row_scalar(
+        y_row, u_row, v_row, src.uv_step, dst_row, x, width);
+  }
+}
+
+VR_TARGET("sse4.1")
+static void _rgb24_to_yuv420_sse41(
+    uint8_t const* src,
+    int src_stride,
+    YUV420Planes const& dst,
+    int width,
+    int height) {
+  RGBShuffle const shuffle = _rgb_shuffle(false);
+  int row = 0;
+  for (; row + 2 <= height; row += 2) {
+    uint8_t const* const row0 = src + row * src_stride;
+    uint8_t const* const row1 = row0 + src_stride;
+    uint8_t* const y_row0 = dst.y + row * dst.y_stride;
+    uint8_t* const y_row1 = y_row0 + dst.y_stride;
+    uint8_t* const u_row = dst.u + (row >> 1) * dst.uv_stride;
+    uint8_t* const v_row = dst.v + (row >> 1) * dst.uv_stride;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i r0, g0, b0, r1, g1, b1;
+      _load_rgb24(row0 + x * 3, &r0, &g0, &b0, shuffle);
+      _load_rgb24(row1 + x * 3, &r1, &g1, &b1, shuffle);
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(y_row0 + x), _rgb_to_y_sse41(r0, g0, b0));
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(y_row1 + x), _rgb_to_y_sse41(r1, g1, b1));
+      __m128i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+      _block_average(r0, r1, &r_lo, &r_hi);
+      _block_average(g0, g1, &g_lo, &g_hi);
+      _block_average(b0, b1, &b_lo, &b_hi);
+      __m128i const zero = _mm_setzero_si128();
+      __m128i const u = _mm_packus_epi16(
+          _mm_packs_epi32(
+              _dot_sse41(r_lo, g_lo, b_lo, -38, -74, 112, 128),
+              _dot_sse41(r_hi, g_hi, b_hi, -38, -74, 112, 128)),
+          zero);
+      __m128i const v = _mm_packus_epi16(
+          _mm_packs_epi32(
+              _dot_sse41(r_lo, g_lo, b_lo, 112, -94, -18, 128),
+              _dot_sse41(r_hi, g_hi, b_hi, 112, -94, -18, 128)),
+          zero);
+      _store_chroma(u_row, v_row, dst.uv_step, x, u, v);
+    }
+    _rgb24_to_yuv420_rows_scalar(
+        row0, row1, y_row0, y_row1, u_row, v_row, dst.uv_step, x, width);
+  }
+  if (row < height) {
+    _rgb24_to_yuv420_rows_scalar(
+        src + row * src_stride,
+        nullptr,
+        dst.y + row * dst.y_stride,
+        nullptr,
+        dst.u + (row >> 1) * dst.uv_stride,
+        dst.v + (row >> 1) * dst.uv_stride,
+        dst.uv_step,
+        0,
+        width);
+  }
+}
+
+// 2 x 8 int32 -> 16 saturated bytes
+VR_TARGET("avx2")
+static inline __m128i _narrow_u8_avx2(__m256i lo, __m256i hi) {
+  // `packs` works within 128 bit lanes, restore the order
+  __m256i const packed =
+      _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+  return _mm_packus_epi16(
+      _mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+}
+
+VR_TARGET("avx2")
+static inline __m256i _dot_avx2(
+    __m256i r, __m256i g, __m256i b, int kr, int kg, int kb, int offset) {
+  __m256i sum = _mm256_add_epi32(
+      _mm256_add_epi32(
+          _mm256_mullo_epi32(r, _mm256_set1_epi32(kr)),
+          _mm256_mullo_epi32(g, _mm256_set1_epi32(kg))),
+      _mm256_mullo_epi32(b, _mm256_set1_epi32(kb)));
+  sum = _mm256_srai_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(128)), 8);
+  return _mm256_add_epi32(sum, _mm256_set1_epi32(offset));
+}
+
+VR_TARGET("avx2")
+static inline __m128i _rgb_to_y_avx2(__m128i r, __m128i g, __m128i b) {
+  __m256i const lo = _dot_avx2(
+      _mm256_cvtepu8_epi32(r),
+      _mm256_cvtepu8_epi32(g),
+      _mm256_cvtepu8_epi32(b),
+      66,
+      129,
+      25,
+      16);
+  __m256i const hi = _dot_avx2(
+      _mm256_cvtepu8_epi32(_mm_srli_si128(r, 8)),
+      _mm256_cvtepu8_epi32(_mm_srli_si128(g, 8)),
+      _mm256_cvtepu8_epi32(_mm_srli_si128(b, 8)),
+      66,
+      129,
+      25,
+      16);
+  return _narrow_u8_avx2(lo, hi);
+}
+
+VR_TARGET("avx2")
+static inline __m256i _join(__m128i lo, __m128i hi) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+// 8 int32 -> 8 saturated bytes in the low half
+VR_TARGET("avx2")
+static inline __m128i _narrow_u8_half_avx2(__m256i values) {
+  return _mm_packus_epi16(
+      _mm_packs_epi32(
+          _mm256_castsi256_si128(values),
+          _mm256_extracti128_si256(values, 1)),
+      _mm_setzero_si128());
+}
+
+VR_TARGET("avx2")
+static void _yuv420_to_rgb24_avx2(
+    YUV420Planes const& src,
+    uint8_t* dst,
+    int dst_stride,
+    int width,
+    int height) {
+  RGBShuffle const shuffle = _rgb_shuffle(true);
+  __m256i const k16 = _mm256_set1_epi32(16);
+  __m256i const k128 = _mm256_set1_epi32(128);
+  __m256i const k298 = _mm256_set1_epi32(298);
+  __m256i const k409 = _mm256_set1_epi32(409);
+  __m256i const k100 = _mm256_set1_epi32(100);
+  __m256i const k208 = _mm256_set1_epi32(208);
+  __m256i const k516 = _mm256_set1_epi32(516);
+  for (int row = 0; row < height; ++row) {
+    uint8_t const* const y_row = src.y + row * src.y_stride;
+    uint8_t const* const u_row = src.u + (row >> 1) * src.uv_stride;
+    uint8_t const* const v_row = src.v + (row >> 1) * src.uv_stride;
+    uint8_t* const dst_row = dst + row * dst_stride;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i u, v;
+      _load_chroma(u_row, v_row, src.uv_step, x, &u, &v);
+      __m128i const y =
+          _mm_loadu_si128(reinterpret_cast<__m128i const*>(y_row + x));
+      __m256i r32[2], g32[2], b32[2];
+      for (int half = 0; half < 2; ++half) {
+        __m128i const y8 = half == 0 ? y : _mm_srli_si128(y, 8);
+        __m128i const u8 = half == 0 ? u : _mm_srli_si128(u, 8);
+        __m128i const v8 = half == 0 ? v : _mm_srli_si128(v, 8);
+        __m256i const c = _mm256_mullo_epi32(
+            _mm256_sub_epi32(_mm256_cvtepu8_epi32(y8), k16), k298);
+        __m256i const d = _mm256_sub_epi32(_mm256_cvtepu8_epi32(u8), k128);
+        __m256i const e = _mm256_sub_epi32(_mm256_cvtepu8_epi32(v8), k128);
+        __m256i const c_round = _mm256_add_epi32(c, k128);
+        r32[half] = _mm256_srai_epi32(
+            _mm256_add_epi32(c_round, _mm256_mullo_epi32(e, k409)), 8);
+        g32[half] = _mm256_srai_epi32(
+            _mm256_sub_epi32(
+                _mm256_sub_epi32(c_round, _mm256_mullo_epi32(d, k100)),
+                _mm256_mullo_epi32(e, k208)),
+            8);
+        b32[half] = _mm256_srai_epi32(
+            _mm256_add_epi32(c_round, _mm256_mullo_epi32(d, k516)), 8);
+      }
+      _store_rgb24(
+          dst_row + x * 3,
+          _narrow_u8_avx2(r32[0], r32[1]),
+          _narrow_u8_avx2(g32[0], g32[1]),
+          _narrow_u8_avx2(b32[0], b32[1]),
+          shuffle);
+    }
+    _yuv420_to_rgb24_row_scalar(
+        y_row, u_row, v_row, src.uv_step, dst_row, x, width);
+  }
+}
+
+VR_TARGET("avx2")
+static void _rgb24_to_yuv420_avx2(
+    uint8_t const* src,
+    int src_stride,
+    YUV420Planes const& dst,
+    int width,
+    int height) {
+  RGBShuffle const shuffle = _rgb_shuffle(false);
+  int row = 0;
+  for (; row + 2 <= height; row += 2) {
+    uint8_t const* const row0 = src + row * src_stride;
+    uint8_t const* const row1 = row0 + src_stride;
+    uint8_t* const y_row0 = dst.y + row * dst.y_stride;
+    uint8_t* const y_row1 = y_row0 + dst.y_stride;
+    uint8_t* const u_row = dst.u + (row >> 1) * dst.uv_stride;
+    uint8_t* const v_row = dst.v + (row >> 1) * dst.uv_stride;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i r0, g0, b0, r1, g1, b1;
+      _load_rgb24(row0 + x * 3, &r0, &g0, &b0, shuffle);
+      _load_rgb24(row1 + x * 3, &r1, &g1, &b1, shuffle);
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(y_row0 + x), _rgb_to_y_avx2(r0, g0, b0));
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(y_row1 + x), _rgb_to_y_avx2(r1, g1, b1));
+      __m128i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+      _block_average(r0, r1, &r_lo, &r_hi);
+      _block_average(g0, g1, &g_lo, &g_hi);
+      _block_average(b0, b1, &b_lo, &b_hi);
+      __m256i const r = _join(r_lo, r_hi);
+      __m256i const g = _join(g_lo, g_hi);
+      __m256i const b = _join(b_lo, b_hi);
+      __m128i const u =
+          _narrow_u8_half_avx2(_dot_avx2(r, g, b, -38, -74, 112, 128));
+      __m128i const v =
+          _narrow_u8_half_avx2(_dot_avx2(r, g, b, 112, -94, -18, 128));
+      _store_chroma(u_row, v_row, dst.uv_step, x, u, v);
+    }
+    _rgb24_to_yuv420_rows_scalar(
+        row0, row1, y_row0, y_row1, u_row, v_row, dst.uv_step, x, width);
+  }
+  if (row < height) {
+    _rgb24_to_yuv420_rows_scalar(
+        src + row * src_stride,
+        nullptr,
+        dst.y + row * dst.y_stride,
+        nullptr,
+        dst.u + (row >> 1) * dst.uv_stride,
+        dst.v + (row >> 1) * dst.uv_stride,
+        dst.uv_step,
+        0,
+        width);
+  }
+}
+
+#endif  // VR_COLOR_CONVERT_X86
+
+static ColorConvertISA _detect_isa() {
+#if defined(VR_COLOR_CONVERT_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return ColorConvertISA::AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return ColorConvertISA::SSE41;
+  }
+#elif defined(VR_COLOR_CONVERT_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int const max_leaf = info[0];
+  __cpuid(info, 1);
+  bool const sse41 = info[2] & (1 << 19);
+  bool const os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                      (_xgetbv(0) & 6) == 6;  // OS saves ymm registers
+  if (os_avx && max_leaf >= 7) {
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1 << 5)) {
+      return ColorConvertISA::AVX2;
+    }
+  }
+  if (sse41) {
+    return ColorConvertISA::SSE41;
+  }
+#endif
+  return ColorConvertISA::SCALAR;
+}
+
+ColorConvertISA color_convert_isa() {
+  static ColorConvertISA const isa = _detect_isa();
+  return isa;
+}
+
+bool color_convert_isa_supported(ColorConvertISA isa) {
+  return static_cast<int>(isa) <= static_cast<int>(color_convert_isa());
+}
+
+void yuv420_to_rgb24(
+    YUV420Planes const& src,
+    uint8_t* dst,
+    int dst_stride,
+    int width,
+    int height,
+    ColorConvertISA isa) {
+  if (!color_convert_isa_supported(isa)) {
+    throw std::runtime_error("instruction set is not supported by the cpu");
+  }
+  switch (isa) {
+#ifdef VR_COLOR_CONVERT_X86
+  case ColorConvertISA::AVX2:
+    _yuv420_to_rgb24_avx2(src, dst, dst_stride, width, height);
+    return;
+  case ColorConvertISA::SSE41:
+    _yuv420_to_rgb24_sse41(src, dst, dst_stride, width, height);
+    return;
+#endif
+  default:
+    _yuv420_to_rgb24_scalar(src, dst, dst_stride, width, height);
+  }
+}
+
+void rgb24_to_yuv420(
+    uint8_t const* src,
+    int src_stride,
+    YUV420Planes const& dst,
+    int width,
+    int height,
+    ColorConvertISA isa) {
+  if (!color_convert_isa_supported(isa)) {
+    throw std::runtime_error("instruction set is not supported by the cpu");
+  }
+  switch (isa) {
+#ifdef VR_COLOR_CONVERT_X86
+  case ColorConvertISA::AVX2:
+    _rgb24_to_yuv420_avx2(src, src_stride, dst, width, height);
+    return;
+  case ColorConvertISA::SSE41:
+    _rgb24_to_yuv420_sse41(src, src_stride, dst, width, height);
+    return;
+#endif
+  default:
+    _rgb24_to_yuv420_scalar(src, src_stride, dst, width, height);
+  }
+}
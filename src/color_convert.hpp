@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+//
+// Conversions between 8 bit BT.601 limited range YUV 4:2:0 and RGB24
+// without scaling. The coefficients are the BT.601 ones `sws_scale` uses,
+// but the output is not bit exact with it: chroma is not interpolated
+// (all pixels of a 2x2 block share the sample) and rounding differs.
+// Integer only, so every instruction set gives results bit exact with
+// the scalar reference
+//
+
+struct YUV420Planes {
+  uint8_t* y;
+  uint8_t* u;
+  uint8_t* v;  // `u + 1` for NV12
+  int y_stride;
+  int uv_stride;
+  int uv_step;  // 1 for YUV420P, 2 for NV12
+};
+
+enum class ColorConvertISA : int { SCALAR, SSE41, AVX2 };
+
+// best instruction set of the running CPU, detected once
+ColorConvertISA color_convert_isa();
+
+bool color_convert_isa_supported(ColorConvertISA isa);
+
+void yuv420_to_rgb24(
+    YUV420Planes const& src,
+    uint8_t* dst,
+    int dst_stride,
+    int width,
+    int height,
+    ColorConvertISA isa = color_convert_isa());
+
+void rgb24_to_yuv420(
+    uint8_t const* src,
+    int src_stride,
+    YUV420Planes const& dst,
+    int width,
+    int height,
+    ColorConvertISA isa = color_convert_isa());
@@ -1,7 +1,10 @@
 #include "ffmpeg_common.hpp"
+#include "ffmpeg_io.hpp"
 extern "C" {
 #include <libavutil/avutil.h>
 }
+#include <charconv>  // std::from_chars
+#include <stdexcept>  // std::runtime_error
 
 AVDictionaryUP
 _create_dict_from_params_vec(std::vector<std::string> const& parameter_pairs) {
@@ -17,6 +20,38 @@ _create_dict_from_params_vec(std::vector<std::string> const& parameter_pairs) {
   return AVDictionaryUP{options};
 }
 
+int64_t pop_value_int64(
+    AVDictionaryUP& dict, char const* key, int64_t const default_value) {
+  AVDictionaryEntry const* entry = av_dict_get(dict.get(), key, NULL, 0);
+  if (entry != nullptr) {
+    std::string const str{entry->value};
+    AVDictionary* raw_dict = dict.release();
+    av_dict_set(&raw_dict, key, NULL, 0);  // remove item
+    dict.reset(raw_dict);
+    int64_t result{};
+    auto [ptr, ec] =
+        std::from_chars(str.data(), str.data() + str.size(), result);
+    if (ec == std::errc()) {
+      return result;
+    }
+    throw std::runtime_error("`" + str + "` is not a valid int64");
+  }
+  return default_value;
+}
+
+std::string pop_value_string(
+    AVDictionaryUP& dict, char const* key, std::string&& default_value) {
+  AVDictionaryEntry const* entry = av_dict_get(dict.get(), key, NULL, 0);
+  if (entry != nullptr) {
+    std::string const str{entry->value};
+    AVDictionary* raw_dict = dict.release();
+    av_dict_set(&raw_dict, key, NULL, 0);  // remove item
+    dict.reset(raw_dict);
+    return str;
+  }
+  return default_value;
+}
+
 std::string get_av_error(int const errnum) {
   std::string ret(512, '\0');
   if (av_strerror(errnum, ret.data(), 511) == 0) {
@@ -36,6 +71,9 @@ void videoreader_ffmpeg_callback(
     return;
   }
   AVClass* avc = *(AVClass**)avcl;
+  if (!avc) {
+    return;  // e.g. an `AVIOContext` without `av_class`
+  }
   // possible class names:
   // * AVFormatContext
   // * AVCodecContext
@@ -53,7 +91,10 @@ void videoreader_ffmpeg_callback(
     opaque = static_cast<AVCodecContext*>(avcl)->opaque;
     break;
   case 'I':  // AVIOContext
-    opaque = static_cast<AVIOContext*>(avcl)->opaque;
+    // the opaque of a custom `AVIOContext` is its `CustomIO`
+    if (!CustomIO::owns(static_cast<AVIOContext*>(avcl))) {
+      opaque = static_cast<AVIOContext*>(avcl)->opaque;
+    }
     break;
   // case 'R': // SWResampler
   //   opaque = static_cast<SWResampler*>(avcl)->opaque;
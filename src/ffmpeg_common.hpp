@@ -20,6 +20,12 @@ using AVDictionaryUP = std::unique_ptr<AVDictionary, AVDictionaryDeleter>;
 AVDictionaryUP
 _create_dict_from_params_vec(std::vector<std::string> const& parameter_pairs);
 
+// remove `key` from `dict` and return its value
+int64_t pop_value_int64(
+    AVDictionaryUP& dict, char const* key, int64_t const default_value);
+std::string pop_value_string(
+    AVDictionaryUP& dict, char const* key, std::string&& default_value);
+
 std::string get_av_error(int const errnum);
 
 struct AVFrameDeleter {
@@ -0,0 +1,311 @@
+#include "ffmpeg_index.hpp"
+#include <algorithm>  // std::sort
+#include <atomic>
+#include <cstdio>
+#include <cstring>  // std::memcmp
+#include <filesystem>
+#include <random>  // std::random_device
+#include <stdexcept>  // std::runtime_error
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static char const INDEX_MAGIC[8] = {'V', 'R', 'I', 'N', 'D', 'E', 'X', '1'};
+
+static uint64_t _fnv1a(uint64_t hash, void const* data, std::size_t size) {
+  auto const* bytes = static_cast<unsigned char const*>(data);
+  for (std::size_t idx = 0; idx < size; ++idx) {
+    hash = (hash ^ bytes[idx]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::unique_ptr<PacketIndex> PacketIndex::build(
+    AVFormatContext* format_context, AVStream const* av_stream) {
+  // demux only the requested stream
+  std::vector<AVDiscard> discards(format_context->nb_streams);
+  for (unsigned stream_idx = 0; stream_idx < format_context->nb_streams;
+       ++stream_idx) {
+    AVStream* stream = format_context->streams[stream_idx];
+    discards[stream_idx] = stream->discard;
+    if (stream != av_stream) {
+      stream->discard = AVDISCARD_ALL;
+    }
+  }
+  std::unique_ptr<PacketIndex> index{new PacketIndex()};
+  AVPacketUP packet(av_packet_alloc());
+  while (av_read_frame(format_context, packet.get()) >= 0) {
+    if (packet->stream_index == av_stream->index) {
+      index->owned_entries.push_back(PacketIndexEntry{
+          packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts,
+          packet->dts,
+          packet->pos,
+          packet->size,
+          packet->flags});
+    }
+    av_packet_unref(packet.get());
+  }
+  for (unsigned stream_idx = 0; stream_idx < format_context->nb_streams;
+       ++stream_idx) {
+    format_context->streams[stream_idx]->discard = discards[stream_idx];
+  }
+  index->entries = index->owned_entries.data();
+  index->count = index->owned_entries.size();
+  index->init_presentation_order();
+  return index;
+}
+
+std::unique_ptr<PacketIndex> PacketIndex::load(
+    std::string const& path,
+    uint64_t file_size,
+    int64_t file_mtime,
+    int stream_index) {
+  std::unique_ptr<PacketIndex> index{new PacketIndex()};
+#ifdef _WIN32
+  HANDLE const file = CreateFileA(
+      path.c_str(),
+      GENERIC_READ,
+      FILE_SHARE_READ,
+      NULL,
+      OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,
+      NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  LARGE_INTEGER size{};
+  GetFileSizeEx(file, &size);
+  HANDLE const mapping =
+      CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL) {
+    return nullptr;
+  }
+  void* const data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (data == NULL) {
+    return nullptr;
+  }
+  index->mapping = data;
+  index->mapping_size = static_cast<std::size_t>(size.QuadPart);
+#else
+  int const fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  void* const data = mmap(
+      nullptr,
+      static_cast<std::size_t>(st.st_size),
+      PROT_READ,
+      MAP_SHARED,
+      fd,
+      0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  index->mapping = data;
+  index->mapping_size = static_cast<std::size_t>(st.st_size);
+#endif
+  if (index->mapping_size < sizeof(PacketIndexHeader)) {
+    return nullptr;
+  }
+  auto const* header = static_cast<PacketIndexHeader const*>(index->mapping);
+  if (std::memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      header->file_size != file_size || header->file_mtime != file_mtime ||
+      header->stream_index != stream_index ||
+      header->entry_size != sizeof(PacketIndexEntry) ||
+      index->mapping_size != sizeof(PacketIndexHeader) +
+                                 header->count * sizeof(PacketIndexEntry)) {
+    return nullptr;  // stale or foreign
+  }
+  index->entries = reinterpret_cast<PacketIndexEntry const*>(header + 1);
+  index->count = header->count;
+  index->init_presentation_order();
+  return index;
+}
+
+void PacketIndex::save(
+    std::string const& path,
+    uint64_t file_size,
+    int64_t file_mtime,
+    int stream_index) const {
+  PacketIndexHeader header{};
+  std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.file_size = file_size;
+  header.file_mtime = file_mtime;
+  header.stream_index = stream_index;
+  header.entry_size = sizeof(PacketIndexEntry);
+  header.count = this->count;
+
+  std::string const tmp_path = unique_temporary_path(path);
+  std::FILE* out = std::fopen(tmp_path.c_str(), "wbx");
+  if (out == nullptr) {
+    throw std::runtime_error("can't write index `" + tmp_path + "`");
+  }
+  bool const ok = std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+                  std::fwrite(
+                      this->entries,
+                      sizeof(PacketIndexEntry),
+                      this->count,
+                      out) == this->count;
+  if (std::fclose(out) != 0 || !ok) {
+    std::remove(tmp_path.c_str());
+    throw std::runtime_error("can't write index `" + tmp_path + "`");
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    std::remove(tmp_path.c_str());
+    throw std::runtime_error(
+        "can't write index `" + path + "`: " + ec.message());
+  }
+}
+
+PacketIndex::~PacketIndex() {
+  if (this->mapping) {
+#ifdef _WIN32
+    UnmapViewOfFile(this->mapping);
+#else
+    munmap(this->mapping, this->mapping_size);
+#endif
+  }
+}
+
+void PacketIndex::init_presentation_order() {
+  this->presentation_order.resize(this->count);
+  for (uint32_t idx = 0; idx < this->count; ++idx) {
+    this->presentation_order[idx] = idx;
+  }
+  std::stable_sort(
+      this->presentation_order.begin(),
+      this->presentation_order.end(),
+      [this](uint32_t a, uint32_t b) {
+        return this->entries[a].pts < this->entries[b].pts;
+      });
+}
+
+int64_t PacketIndex::frame_timestamp(number_t number) const {
+  if (number >= this->count) {
+    throw std::runtime_error(
+        "frame " + std::to_string(number) + " is out of range (" +
+        std::to_string(this->count) + " frames)");
+  }
+  return this->entries[this->presentation_order[number]].pts;
+}
+
+PacketIndex::number_t PacketIndex::frame_number(int64_t timestamp) const {
+  auto const it = std::lower_bound(
+      this->presentation_order.begin(),
+      this->presentation_order.end(),
+      timestamp,
+      [this](uint32_t idx, int64_t timestamp) {
+        return this->entries[idx].pts < timestamp;
+      });
+  return static_cast<number_t>(it - this->presentation_order.begin());
+}
+
+int64_t PacketIndex::keyframe_timestamp(int64_t timestamp) const {
+  number_t const number = this->frame_number(timestamp);
+  if (number >= this->count) {
+    return timestamp;  // past the end, let the demuxer decide
+  }
+  // walk back in decode order to the closest keyframe shown before the frame
+  for (int64_t idx = this->presentation_order[number]; idx >= 0; --idx) {
+    PacketIndexEntry const& entry = this->entries[idx];
+    if ((entry.flags & AV_PKT_FLAG_KEY) && entry.pts <= timestamp) {
+      return entry.pts;
+    }
+  }
+  return this->count ? this->entries[0].pts : timestamp;
+}
+
+std::string get_local_path(std::string const& url) {
+  if (url.rfind("file:", 0) == 0) {
+    return url.substr(5);
+  }
+  if (url.find("://") != std::string::npos) {
+    return {};
+  }
+  return url;
+}
+
+bool get_file_key(std::string const& path, uint64_t* size, int64_t* mtime) {
+  std::error_code ec;
+  auto const file_size = std::filesystem::file_size(path, ec);
+  if (ec) {
+    return false;
+  }
+  auto const file_time = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return false;
+  }
+  *size = static_cast<uint64_t>(file_size);
+  *mtime = static_cast<int64_t>(file_time.time_since_epoch().count());
+  return true;
+}
+
+std::string unique_temporary_path(std::string const& path) {
+  static std::atomic<uint64_t> counter{0};  // threads of one process
+  std::random_device random;  // processes
+  char suffix[48];
+  std::snprintf(
+      suffix,
+      sizeof(suffix),
+      ".%08x%08x.%llu.tmp",
+      random(),
+      random(),
+      static_cast<unsigned long long>(counter++));
+  return path + suffix;
+}
+
+bool get_stream_key(
+    AVFormatContext* format_context,
+    AVStream const* av_stream,
+    uint64_t* size,
+    int64_t* fingerprint) {
+  // enough to cover the first keyframe and its dependent frames
+  int const KEY_PACKETS = 16;
+  int64_t const stream_size =
+      format_context->pb ? avio_size(format_context->pb) : -1;
+  if (stream_size <= 0) {
+    return false;
+  }
+  uint64_t hash = 14695981039346656037ULL;  // FNV-1a, stable across runs
+  hash = _fnv1a(
+      hash, &format_context->duration, sizeof(format_context->duration));
+  if (av_stream->codecpar->extradata) {
+    hash = _fnv1a(
+        hash,
+        av_stream->codecpar->extradata,
+        static_cast<std::size_t>(av_stream->codecpar->extradata_size));
+  }
+  AVPacketUP packet(av_packet_alloc());
+  int packets = 0;
+  while (packets < KEY_PACKETS &&
+         av_read_frame(format_context, packet.get()) >= 0) {
+    if (packet->stream_index == av_stream->index) {
+      int64_t const fields[] = {
+          packet->pts, packet->dts, packet->size, packet->flags};
+      hash = _fnv1a(hash, fields, sizeof(fields));
+      hash = _fnv1a(
+          hash, packet->data, static_cast<std::size_t>(packet->size));
+      ++packets;
+    }
+    av_packet_unref(packet.get());
+  }
+  *size = static_cast<uint64_t>(stream_size);
+  *fingerprint = static_cast<int64_t>(hash);
+  return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "ffmpeg_common.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+//
+// Demux-only index of a video stream: one entry per packet in decode order.
+// Gives exact frame counts (`AVStream::nb_frames` is 0 for many containers)
+// and keyframe targets for seeking.
+//
+// Sidecar file layout (native byte order, memory-mappable):
+//   PacketIndexHeader
+//   PacketIndexEntry[count]
+//
+struct PacketIndexEntry {
+  int64_t pts;  // `dts` when the container doesn't store pts
+  int64_t dts;
+  int64_t pos;  // byte position in the file or -1
+  int32_t size;
+  int32_t flags;  // AV_PKT_FLAG_*
+};
+static_assert(sizeof(PacketIndexEntry) == 32, "unexpected padding");
+
+struct PacketIndexHeader {
+  char magic[8];  // "VRINDEX1"
+  uint64_t file_size;  // the key, index is rebuilt when
+  int64_t file_mtime;  // the video file changes (see `get_stream_key`)
+  int32_t stream_index;
+  int32_t entry_size;  // sizeof(PacketIndexEntry)
+  uint64_t count;
+};
+static_assert(sizeof(PacketIndexHeader) == 40, "unexpected padding");
+
+class PacketIndex {
+public:
+  using number_t = uint64_t;
+
+  // reads all packets of `av_stream` from the current position of
+  // `format_context`. Caller is responsible for seeking back
+  static std::unique_ptr<PacketIndex>
+  build(AVFormatContext* format_context, AVStream const* av_stream);
+
+  // returns nullptr when `path` doesn't exist or was built for another file
+  static std::unique_ptr<PacketIndex> load(
+      std::string const& path,
+      uint64_t file_size,
+      int64_t file_mtime,
+      int stream_index);
+
+  // atomically (write + rename) stores the index as a sidecar file
+  void save(
+      std::string const& path,
+      uint64_t file_size,
+      int64_t file_mtime,
+      int stream_index) const;
+
+  ~PacketIndex();
+
+  number_t size() const {
+    return this->count;
+  }
+  PacketIndexEntry const& operator[](std::size_t idx) const {
+    return this->entries[idx];
+  }
+
+  // presentation timestamp of frame `number`
+  int64_t frame_timestamp(number_t number) const;
+
+  // number of the first frame with pts >= `timestamp`
+  number_t frame_number(int64_t timestamp) const;
+
+  // pts of the keyframe decoding should start from to get frame `timestamp`
+  int64_t keyframe_timestamp(int64_t timestamp) const;
+
+private:
+  PacketIndex() = default;
+  void init_presentation_order();
+
+  PacketIndexEntry const* entries{};
+  number_t count{};
+  std::vector<PacketIndexEntry> owned_entries;  // when built
+  void* mapping{};  // when loaded
+  std::size_t mapping_size{};
+  // entry indices sorted by pts, i.e. frame number -> decode order index
+  std::vector<uint32_t> presentation_order;
+};
+
+// file path for local files, empty string for network urls
+std::string get_local_path(std::string const& url);
+
+// size and modification time of a local file
+bool get_file_key(std::string const& path, uint64_t* size, int64_t* mtime);
+
+// file to write before renaming it to `path`, in the same directory.
+// Unique, so processes storing the same file at once don't truncate each
+// other's writes
+std::string unique_temporary_path(std::string const& path);
+
+// index key for a video without a local file: the size the protocol
+// reports (e.g. HTTP Content-Length) and a hash of the duration, codec
+// extradata and first packets of `av_stream` in place of the mtime.
+// Reads from the current position, caller is responsible for seeking back.
+// false when the size is unknown, so changes can't be detected
+bool get_stream_key(
+    AVFormatContext* format_context,
+    AVStream const* av_stream,
+    uint64_t* size,
+    int64_t* fingerprint);
@@ -0,0 +1,451 @@
+#include "ffmpeg_io.hpp"
+#include "ffmpeg_index.hpp"  // get_local_path
+extern "C" {
+#include <libavutil/mem.h>
+}
+#include <algorithm>  // std::min
+#include <cerrno>  // EINVAL
+#include <cstdio>  // SEEK_SET
+#include <cstring>  // std::memcpy
+#include <stdexcept>  // std::runtime_error
+#ifndef _WIN32
+#include <fcntl.h>  // open
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>  // pread
+#endif
+#ifdef __linux__
+#include <sys/vfs.h>  // statfs
+#endif
+
+// absolute position for `AVIOContext::seek` arguments, -1 when unknown
+static int64_t
+_seek_target(int64_t offset, int whence, int64_t position, int64_t size) {
+  switch (whence) {
+  case SEEK_SET:
+    return offset;
+  case SEEK_CUR:
+    return position + offset;
+  case SEEK_END:
+    return size >= 0 ? size + offset : -1;
+  }
+  return -1;
+}
+
+CustomIO::~CustomIO() {
+  if (this->io_context) {
+    av_freep(&this->io_context->buffer);
+    avio_context_free(&this->io_context);
+  }
+}
+
+std::unique_ptr<CustomIO> CustomIO::clone() const {
+  return nullptr;
+}
+
+bool CustomIO::owns(AVIOContext const* context) {
+  return context->read_packet == &CustomIO::read_packet;
+}
+
+void CustomIO::open(std::size_t buffer_size, bool seekable) {
+  unsigned char* const buffer =
+      static_cast<unsigned char*>(av_malloc(buffer_size));
+  if (!buffer) {
+    throw std::runtime_error("failed to allocate AVIOContext buffer");
+  }
+  this->io_context = avio_alloc_context(
+      buffer,
+      static_cast<int>(buffer_size),
+      0,
+      this,
+      &CustomIO::read_packet,
+      nullptr,
+      seekable ? &CustomIO::seek_packet : nullptr);
+  if (!this->io_context) {
+    av_free(buffer);
+    throw std::runtime_error("failed to allocate AVIOContext");
+  }
+}
+
+int CustomIO::read_packet(void* opaque, uint8_t* buffer, int size) {
+  return static_cast<CustomIO*>(opaque)->read(buffer, size);
+}
+
+int64_t CustomIO::seek_packet(void* opaque, int64_t offset, int whence) {
+  return static_cast<CustomIO*>(opaque)->seek(offset, whence & ~AVSEEK_FORCE);
+}
+
+MemoryIO::MemoryIO(
+    uint8_t const* data, std::size_t size, std::size_t buffer_size) :
+    data{data},
+    size{size},
+    buffer_size{buffer_size} {
+  this->open(std::min(buffer_size, std::max(size, std::size_t{1})), true);
+}
+
+std::unique_ptr<CustomIO> MemoryIO::clone() const {
+  return std::make_unique<MemoryIO>(this->data, this->size, this->buffer_size);
+}
+
+int MemoryIO::read(uint8_t* buffer, int size) {
+  std::size_t const count = std::min(
+      static_cast<std::size_t>(size), this->size - this->position);
+  if (count == 0) {
+    return AVERROR_EOF;
+  }
+  std::memcpy(buffer, this->data + this->position, count);
+  this->position += count;
+  return static_cast<int>(count);
+}
+
+int64_t MemoryIO::seek(int64_t offset, int whence) {
+  int64_t const size = static_cast<int64_t>(this->size);
+  if (whence == AVSEEK_SIZE) {
+    return size;
+  }
+  int64_t const target = _seek_target(
+      offset, whence, static_cast<int64_t>(this->position), size);
+  if (target < 0 || target > size) {
+    return AVERROR(EINVAL);
+  }
+  this->position = static_cast<std::size_t>(target);
+  return target;
+}
+
+StreamIO::StreamIO(VideoReader::StreamCallbacks const& callbacks) :
+    callbacks{callbacks} {
+  if (!callbacks.read) {
+    throw std::runtime_error("stream read callback is required");
+  }
+  this->open(DEFAULT_IO_BUFFER_SIZE, callbacks.seek != nullptr);
+}
+
+int StreamIO::read(uint8_t* buffer, int size) {
+  int64_t const count = this->callbacks.read(
+      buffer, static_cast<std::size_t>(size), this->callbacks.opaque);
+  if (count == 0) {
+    return AVERROR_EOF;
+  }
+  if (count < 0 || count > size) {
+    return AVERROR(EIO);
+  }
+  this->position += count;
+  return static_cast<int>(count);
+}
+
+int64_t StreamIO::seek(int64_t offset, int whence) {
+  if (whence == AVSEEK_SIZE) {
+    return this->callbacks.size >= 0 ? this->callbacks.size : AVERROR(ENOSYS);
+  }
+  int64_t const target =
+      _seek_target(offset, whence, this->position, this->callbacks.size);
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+  int64_t const ret = this->callbacks.seek(target, this->callbacks.opaque);
+  if (ret < 0) {
+    return AVERROR(EIO);
+  }
+  this->position = ret;
+  return ret;
+}
+
+#ifndef _WIN32
+
+struct MappedFile {
+  uint8_t const* data = nullptr;
+  std::size_t size = 0;
+
+  explicit MappedFile(std::string const& path) {
+    int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error("failed to open `" + path + "`");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      close(fd);
+      throw std::runtime_error("`" + path + "` is not a regular file");
+    }
+    this->size = static_cast<std::size_t>(st.st_size);
+    if (this->size != 0) {
+      void* const data =
+          mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("failed to map `" + path + "`");
+      }
+      madvise(data, this->size, MADV_SEQUENTIAL);
+      this->data = static_cast<uint8_t const*>(data);
+    }
+    close(fd);  // the mapping keeps the file
+  }
+
+  ~MappedFile() {
+    if (this->data) {
+      munmap(const_cast<uint8_t*>(this->data), this->size);
+    }
+  }
+
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+};
+
+MappedFileIO::MappedFileIO(std::string const& path, std::size_t buffer_size) :
+    MappedFileIO(std::make_shared<MappedFile const>(path), buffer_size) {
+}
+
+MappedFileIO::MappedFileIO(
+    std::shared_ptr<MappedFile const> file, std::size_t buffer_size) :
+    MemoryIO(file->data, file->size, buffer_size),
+    file{std::move(file)},
+    buffer_size{buffer_size} {
+}
+
+std::unique_ptr<CustomIO> MappedFileIO::clone() const {
+  return std::unique_ptr<CustomIO>(
+      new MappedFileIO(this->file, this->buffer_size));
+}
+
+ReadAheadIO::ReadAheadIO(std::string const& path, std::size_t window_size) :
+    path{path},
+    window_size{window_size} {
+  this->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (this->fd < 0) {
+    throw std::runtime_error("failed to open `" + path + "`");
+  }
+  struct stat st;
+  if (fstat(this->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(this->fd);
+    throw std::runtime_error("`" + path + "` is not a regular file");
+  }
+  this->file_size = st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(this->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  std::size_t const chunk_size =
+      std::max(window_size / CHUNKS, DEFAULT_IO_BUFFER_SIZE);
+  for (std::size_t idx = 0; idx < CHUNKS; ++idx) {
+    this->spare.emplace_back(chunk_size);
+  }
+  try {
+    this->open(DEFAULT_IO_BUFFER_SIZE, true);
+  } catch (...) {
+    close(this->fd);
+    throw;
+  }
+  this->thread = std::thread(&ReadAheadIO::work, this);
+}
+
+ReadAheadIO::~ReadAheadIO() {
+  {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->stop_requested = true;
+  }
+  this->cv.notify_all();
+  this->thread.join();
+  close(this->fd);
+}
+
+std::unique_ptr<CustomIO> ReadAheadIO::clone() const {
+  return std::make_unique<ReadAheadIO>(this->path, this->window_size);
+}
+
+void ReadAheadIO::work() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    this->cv.wait(lock, [this] {
+      return this->stop_requested ||
+             (!this->spare.empty() && !this->eof && this->error == 0 &&
+              this->read_offset < this->file_size);
+    });
+    if (this->stop_requested) {
+      return;
+    }
+    std::vector<uint8_t> data = std::move(this->spare.back());
+    this->spare.pop_back();
+    int64_t const offset = this->read_offset;
+    std::size_t const size = static_cast<std::size_t>(std::min(
+        static_cast<int64_t>(data.size()), this->file_size - offset));
+    this->read_offset = offset + static_cast<int64_t>(size);
+    uint64_t const generation = this->generation;
+    lock.unlock();
+
+    std::size_t done = 0;
+    int error = 0;
+    while (done < size) {
+      ssize_t const count =
+          pread(this->fd, data.data() + done, size - done, offset + done);
+      if (count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        error = errno;
+        break;
+      }
+      if (count == 0) {
+        break;
+      }
+      done += static_cast<std::size_t>(count);
+    }
+
+    lock.lock();
+    if (generation != this->generation) {  // the demuxer seeked away
+      this->spare.push_back(std::move(data));
+      continue;
+    }
+    if (error) {
+      this->error = error;
+      this->spare.push_back(std::move(data));
+    } else {
+      if (done < size) {
+        this->eof = true;
+        this->read_offset = offset + static_cast<int64_t>(done);
+      }
+      this->ready.push_back(Chunk{offset, std::move(data), done});
+    }
+    this->cv.notify_all();
+  }
+}
+
+void ReadAheadIO::restart(int64_t offset) {
+  while (!this->ready.empty()) {
+    this->spare.push_back(std::move(this->ready.front().data));
+    this->ready.pop_front();
+  }
+  this->window_begin = this->read_offset = offset;
+  this->eof = false;
+  this->error = 0;
+  ++this->generation;
+  this->cv.notify_all();
+}
+
+void ReadAheadIO::release_front() {
+  Chunk& chunk = this->ready.front();
+  this->window_begin = chunk.offset + static_cast<int64_t>(chunk.size);
+  this->spare.push_back(std::move(chunk.data));
+  this->ready.pop_front();
+  this->cv.notify_all();
+}
+
+int ReadAheadIO::read(uint8_t* buffer, int size) {
+  if (this->position >= this->file_size) {
+    return AVERROR_EOF;
+  }
+  std::unique_lock<std::mutex> lock(this->mutex);
+  if (this->position < this->window_begin ||
+      this->position > this->read_offset) {
+    this->restart(this->position);
+  }
+  while (true) {
+    while (!this->ready.empty() &&
+           this->ready.front().offset +
+                   static_cast<int64_t>(this->ready.front().size) <=
+               this->position) {
+      this->release_front();
+    }
+    if (!this->ready.empty()) {
+      break;
+    }
+    if (this->error) {
+      return AVERROR(this->error);
+    }
+    if (this->eof && this->read_offset <= this->position) {
+      return AVERROR_EOF;
+    }
+    this->cv.wait(lock);
+  }
+  Chunk const& chunk = this->ready.front();
+  std::size_t const skip =
+      static_cast<std::size_t>(this->position - chunk.offset);
+  std::size_t const count =
+      std::min(static_cast<std::size_t>(size), chunk.size - skip);
+  std::memcpy(buffer, chunk.data.data() + skip, count);
+  this->position += static_cast<int64_t>(count);
+  if (skip + count == chunk.size) {
+    this->release_front();
+  }
+  return static_cast<int>(count);
+}
+
+int64_t ReadAheadIO::seek(int64_t offset, int whence) {
+  if (whence == AVSEEK_SIZE) {
+    return this->file_size;
+  }
+  int64_t const target =
+      _seek_target(offset, whence, this->position, this->file_size);
+  if (target < 0 || target > this->file_size) {
+    return AVERROR(EINVAL);
+  }
+  this->position = target;  // `read` restarts reading when needed
+  return target;
+}
+
+static bool _is_network_filesystem(std::string const& path) {
+#ifdef __linux__
+  struct statfs st;
+  if (statfs(path.c_str(), &st) != 0) {
+    return false;
+  }
+  switch (static_cast<uint32_t>(st.f_type)) {
+  case 0x6969:  // NFS
+  case 0x517B:  // SMB
+  case 0xFE534D42:  // SMB2
+  case 0xFF534D42:  // CIFS
+  case 0x65735546:  // FUSE (sshfs, s3fs, ...)
+  case 0x00C36400:  // Ceph
+  case 0x01021997:  // 9P
+  case 0x0BD00BD0:  // Lustre
+  case 0x47504653:  // GPFS
+    return true;
+  }
+#endif
+  return false;
+}
+
+std::unique_ptr<CustomIO> open_file_io(
+    std::string const& url, std::string const& mode, int64_t buffer_size) {
+  if (mode == "ffmpeg") {
+    return nullptr;
+  }
+  if (mode != "auto" && mode != "mmap" && mode != "readahead") {
+    throw std::runtime_error(
+        "unknown file_io: `" + mode +
+        "`. Possible values are: 'ffmpeg', 'auto', 'mmap', 'readahead'");
+  }
+  if (buffer_size < 0) {
+    throw std::runtime_error("io_buffer_size must not be negative");
+  }
+  std::string const path = get_local_path(url);
+  if (mode == "auto") {
+    struct stat st;
+    if (path.empty() || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      return nullptr;
+    }
+  } else if (path.empty()) {
+    throw std::runtime_error("file_io `" + mode + "` requires a local file");
+  }
+  bool const read_ahead = mode == "readahead" ||
+                          (mode == "auto" && _is_network_filesystem(path));
+  if (read_ahead) {
+    return std::make_unique<ReadAheadIO>(
+        path,
+        buffer_size ? static_cast<std::size_t>(buffer_size)
+                    : ReadAheadIO::DEFAULT_WINDOW_SIZE);
+  }
+  return std::make_unique<MappedFileIO>(
+      path,
+      buffer_size ? static_cast<std::size_t>(buffer_size)
+                  : DEFAULT_IO_BUFFER_SIZE);
+}
+
+#else
+
+std::unique_ptr<CustomIO> open_file_io(
+    std::string const& url, std::string const& mode, int64_t buffer_size) {
+  if (mode == "ffmpeg" || mode == "auto") {
+    return nullptr;
+  }
+  throw std::runtime_error("file_io `" + mode + "` requires a POSIX system");
+}
+
+#endif
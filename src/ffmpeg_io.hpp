@@ -0,0 +1,160 @@
+#pragma once
+extern "C" {
+#include <libavformat/avio.h>
+}
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <videoreader/videoreader.hpp>
+
+// `AVIOContext` buffer, the size of `av_read_frame` reads
+constexpr std::size_t DEFAULT_IO_BUFFER_SIZE = 64 * 1024;
+
+//
+// Source of bytes for `_get_format_context` in place of a protocol url.
+// Owns the `AVIOContext` that calls `read` and `seek`
+//
+class CustomIO {
+public:
+  virtual ~CustomIO();
+  CustomIO(CustomIO const&) = delete;
+  CustomIO& operator=(CustomIO const&) = delete;
+
+  AVIOContext* context() const {
+    return this->io_context;
+  }
+
+  // independent reader of the same bytes for another demuxer,
+  // nullptr when the bytes can be read only once
+  virtual std::unique_ptr<CustomIO> clone() const;
+
+  // whether `context` was opened by a `CustomIO`, its opaque is then
+  // the `CustomIO`
+  static bool owns(AVIOContext const* context);
+
+protected:
+  CustomIO() = default;
+  // call from derived constructors
+  void open(std::size_t buffer_size, bool seekable);
+  // returns the number of bytes, AVERROR_EOF or another AVERROR
+  virtual int read(uint8_t* buffer, int size) = 0;
+  // `whence` is SEEK_SET, SEEK_CUR, SEEK_END or AVSEEK_SIZE
+  virtual int64_t seek(int64_t offset, int whence) = 0;
+
+private:
+  static int read_packet(void* opaque, uint8_t* buffer, int size);
+  static int64_t seek_packet(void* opaque, int64_t offset, int whence);
+
+  AVIOContext* io_context = nullptr;
+};
+
+// `size` bytes at `data`, not copied
+class MemoryIO : public CustomIO {
+public:
+  MemoryIO(
+      uint8_t const* data,
+      std::size_t size,
+      std::size_t buffer_size = DEFAULT_IO_BUFFER_SIZE);
+  std::unique_ptr<CustomIO> clone() const override;
+
+protected:
+  int read(uint8_t* buffer, int size) override;
+  int64_t seek(int64_t offset, int whence) override;
+
+private:
+  uint8_t const* const data;
+  std::size_t const size;
+  std::size_t const buffer_size;
+  std::size_t position = 0;
+};
+
+// `VideoReader::StreamCallbacks`
+class StreamIO : public CustomIO {
+public:
+  explicit StreamIO(VideoReader::StreamCallbacks const& callbacks);
+
+protected:
+  int read(uint8_t* buffer, int size) override;
+  int64_t seek(int64_t offset, int whence) override;
+
+private:
+  VideoReader::StreamCallbacks const callbacks;
+  int64_t position = 0;
+};
+
+// Local file source for the "file_io" option:
+//   "mmap" - `MappedFileIO`, "readahead" - `ReadAheadIO`,
+//   "auto" - "readahead" on network filesystems, "mmap" on others.
+// `buffer_size` of 0 selects the default of the mode. Returns nullptr
+// for "ffmpeg", and for "auto" when `url` isn't a regular local file
+std::unique_ptr<CustomIO> open_file_io(
+    std::string const& url, std::string const& mode, int64_t buffer_size);
+
+struct MappedFile;
+
+// whole file mapped to memory, the kernel reads it ahead. Clones share
+// the mapping
+class MappedFileIO : public MemoryIO {
+public:
+  MappedFileIO(std::string const& path, std::size_t buffer_size);
+  std::unique_ptr<CustomIO> clone() const override;
+
+private:
+  MappedFileIO(
+      std::shared_ptr<MappedFile const> file, std::size_t buffer_size);
+
+  std::shared_ptr<MappedFile const> const file;
+  std::size_t const buffer_size;
+};
+
+// A thread reads the file in large chunks ahead of the demuxer, for
+// filesystems where every small synchronous read costs a round trip.
+// Seeking outside of the buffered window restarts reading there
+class ReadAheadIO : public CustomIO {
+public:
+  static constexpr std::size_t CHUNKS = 4;
+  static constexpr std::size_t DEFAULT_WINDOW_SIZE = 16 << 20;
+
+  // `window_size` bytes are read ahead in `CHUNKS` reads
+  ReadAheadIO(std::string const& path, std::size_t window_size);
+  ~ReadAheadIO() override;
+  std::unique_ptr<CustomIO> clone() const override;
+
+protected:
+  int read(uint8_t* buffer, int size) override;
+  int64_t seek(int64_t offset, int whence) override;
+
+private:
+  struct Chunk {
+    int64_t offset;
+    std::vector<uint8_t> data;
+    std::size_t size;
+  };
+
+  void work();
+  void restart(int64_t offset);  // call with `mutex` locked
+  void release_front();  // call with `mutex` locked
+
+  std::string const path;
+  std::size_t const window_size;
+  int fd;
+  int64_t file_size;
+  int64_t position = 0;  // demuxer thread only
+
+  std::mutex mutex;  // guards everything below
+  std::condition_variable cv;  // chunk read, chunk released, or stop
+  std::deque<Chunk> ready;  // consecutive chunks from `window_begin`
+  std::vector<std::vector<uint8_t>> spare;  // buffers to read chunks into
+  int64_t window_begin = 0;  // first byte that is ready or being read
+  int64_t read_offset = 0;  // first byte not requested yet
+  uint64_t generation = 0;  // incremented by `restart`
+  int error = 0;  // errno of the failed read
+  bool eof = false;  // file turned out shorter than `file_size`
+  bool stop_requested = false;
+  std::thread thread;
+};
@@ -0,0 +1,191 @@
+#include "ffmpeg_probe_cache.hpp"
+#include "ffmpeg_index.hpp"  // unique_temporary_path
+#include <cstdio>
+#include <cstring>  // std::memcmp
+#include <filesystem>
+#include <stdexcept>  // std::runtime_error
+#include <vector>
+
+static char const PROBE_CACHE_MAGIC[8] = {
+    'V', 'R', 'P', 'R', 'O', 'B', 'E', '1'};
+
+static bool _same_rational(AVRational a, AVRational b) {
+  return a.num == b.num && a.den == b.den;
+}
+
+std::string
+probe_cache_path(std::string const& directory, std::string const& key) {
+  uint64_t hash = 14695981039346656037ULL;  // FNV-1a, stable across runs
+  for (unsigned char const c : key) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  char name[32];
+  std::snprintf(
+      name,
+      sizeof(name),
+      "%016llx.vrprobe",
+      static_cast<unsigned long long>(hash));
+  return (std::filesystem::path(directory) / name).string();
+}
+
+AVStream* load_probe_cache(
+    std::string const& path,
+    std::string const& key,
+    uint64_t file_size,
+    int64_t file_mtime,
+    AVFormatContext* format_context) {
+  std::FILE* in = std::fopen(path.c_str(), "rb");
+  if (in == nullptr) {
+    return nullptr;
+  }
+  ProbeCacheHeader header{};
+  std::vector<uint8_t> extradata;
+  std::string cached_key;
+  bool ok = std::fread(&header, sizeof(header), 1, in) == 1 &&
+            std::memcmp(
+                header.magic, PROBE_CACHE_MAGIC, sizeof(PROBE_CACHE_MAGIC)) ==
+                0 &&
+            header.key_size == key.size() &&
+            header.extradata_size < (1U << 30);
+  if (ok) {
+    extradata.resize(header.extradata_size);
+    cached_key.resize(header.key_size);
+    ok = std::fread(extradata.data(), 1, extradata.size(), in) ==
+             extradata.size() &&
+         std::fread(&cached_key[0], 1, cached_key.size(), in) ==
+             cached_key.size();
+  }
+  std::fclose(in);
+  if (!ok || cached_key != key || header.file_size != file_size ||
+      header.file_mtime != file_mtime || header.stream_index < 0 ||
+      static_cast<unsigned>(header.stream_index) >=
+          format_context->nb_streams) {
+    return nullptr;  // stale or foreign
+  }
+  AVStream* const av_stream = format_context->streams[header.stream_index];
+  AVCodecParameters* const codecpar = av_stream->codecpar;
+  if (codecpar->codec_type != header.codec_type ||
+      codecpar->codec_id != header.codec_id ||
+      !_same_rational(av_stream->time_base, header.time_base)) {
+    return nullptr;  // the demuxer sees another stream layout
+  }
+  if (codecpar->extradata_size == 0 && !extradata.empty()) {
+    codecpar->extradata = static_cast<uint8_t*>(
+        av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+    if (!codecpar->extradata) {
+      throw std::runtime_error("failed to allocate extradata");
+    }
+    std::memcpy(codecpar->extradata, extradata.data(), extradata.size());
+    codecpar->extradata_size = static_cast<int>(extradata.size());
+  }
+  codecpar->codec_tag = header.codec_tag;
+  codecpar->format = header.format;
+  codecpar->width = header.width;
+  codecpar->height = header.height;
+  codecpar->profile = header.profile;
+  codecpar->level = header.level;
+  codecpar->field_order =
+      static_cast<decltype(codecpar->field_order)>(header.field_order);
+  codecpar->color_range =
+      static_cast<decltype(codecpar->color_range)>(header.color_range);
+  codecpar->color_primaries = static_cast<decltype(codecpar->color_primaries)>(
+      header.color_primaries);
+  codecpar->color_trc =
+      static_cast<decltype(codecpar->color_trc)>(header.color_trc);
+  codecpar->color_space =
+      static_cast<decltype(codecpar->color_space)>(header.color_space);
+  codecpar->chroma_location = static_cast<decltype(codecpar->chroma_location)>(
+      header.chroma_location);
+  codecpar->video_delay = header.video_delay;
+  codecpar->bits_per_coded_sample = header.bits_per_coded_sample;
+  codecpar->bits_per_raw_sample = header.bits_per_raw_sample;
+  codecpar->sample_aspect_ratio = header.sample_aspect_ratio;
+  codecpar->bit_rate = header.bit_rate;
+  av_stream->sample_aspect_ratio = header.sample_aspect_ratio;
+  av_stream->avg_frame_rate = header.avg_frame_rate;
+  av_stream->r_frame_rate = header.r_frame_rate;
+  if (av_stream->start_time == AV_NOPTS_VALUE) {
+    av_stream->start_time = header.start_time;
+  }
+  if (av_stream->duration == AV_NOPTS_VALUE) {
+    av_stream->duration = header.duration;
+  }
+  if (av_stream->nb_frames == 0) {
+    av_stream->nb_frames = header.nb_frames;
+  }
+  if (format_context->start_time == AV_NOPTS_VALUE) {
+    format_context->start_time = header.format_start_time;
+  }
+  if (format_context->duration == AV_NOPTS_VALUE) {
+    format_context->duration = header.format_duration;
+  }
+  return av_stream;
+}
+
+void save_probe_cache(
+    std::string const& path,
+    std::string const& key,
+    uint64_t file_size,
+    int64_t file_mtime,
+    AVFormatContext const* format_context,
+    AVStream const* av_stream) {
+  AVCodecParameters const* const codecpar = av_stream->codecpar;
+  ProbeCacheHeader header{};
+  std::memcpy(header.magic, PROBE_CACHE_MAGIC, sizeof(PROBE_CACHE_MAGIC));
+  header.file_size = file_size;
+  header.file_mtime = file_mtime;
+  header.stream_index = av_stream->index;
+  header.codec_type = codecpar->codec_type;
+  header.codec_id = codecpar->codec_id;
+  header.codec_tag = codecpar->codec_tag;
+  header.format = codecpar->format;
+  header.width = codecpar->width;
+  header.height = codecpar->height;
+  header.profile = codecpar->profile;
+  header.level = codecpar->level;
+  header.field_order = codecpar->field_order;
+  header.color_range = codecpar->color_range;
+  header.color_primaries = codecpar->color_primaries;
+  header.color_trc = codecpar->color_trc;
+  header.color_space = codecpar->color_space;
+  header.chroma_location = codecpar->chroma_location;
+  header.video_delay = codecpar->video_delay;
+  header.bits_per_coded_sample = codecpar->bits_per_coded_sample;
+  header.bits_per_raw_sample = codecpar->bits_per_raw_sample;
+  header.sample_aspect_ratio = codecpar->sample_aspect_ratio;
+  header.time_base = av_stream->time_base;
+  header.avg_frame_rate = av_stream->avg_frame_rate;
+  header.r_frame_rate = av_stream->r_frame_rate;
+  header.bit_rate = codecpar->bit_rate;
+  header.start_time = av_stream->start_time;
+  header.duration = av_stream->duration;
+  header.nb_frames = av_stream->nb_frames;
+  header.format_start_time = format_context->start_time;
+  header.format_duration = format_context->duration;
+  header.extradata_size =
+      codecpar->extradata ? static_cast<uint32_t>(codecpar->extradata_size) : 0;
+  header.key_size = static_cast<uint32_t>(key.size());
+
+  std::string const tmp_path = unique_temporary_path(path);
+  std::FILE* out = std::fopen(tmp_path.c_str(), "wbx");
+  if (out == nullptr) {
+    throw std::runtime_error("can't write probe cache `" + tmp_path + "`");
+  }
+  bool const ok =
+      std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+      (header.extradata_size == 0 ||
+       std::fwrite(codecpar->extradata, 1, header.extradata_size, out) ==
+           header.extradata_size) &&
+      std::fwrite(key.data(), 1, key.size(), out) == key.size();
+  if (std::fclose(out) != 0 || !ok) {
+    std::remove(tmp_path.c_str());
+    throw std::runtime_error("can't write probe cache `" + tmp_path + "`");
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    std::remove(tmp_path.c_str());
+    throw std::runtime_error(
+        "can't write probe cache `" + path + "`: " + ec.message());
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "ffmpeg_common.hpp"
+#include <cstdint>
+#include <string>
+
+//
+// What `avformat_find_stream_info` learns about the video stream: codec
+// parameters and timing. Stored after the first open of a url, so the
+// next open configures the decoder without reading and decoding ahead.
+//
+// Cache file layout (native byte order):
+//   ProbeCacheHeader
+//   uint8_t extradata[extradata_size]
+//   char key[key_size]
+//
+struct ProbeCacheHeader {
+  char magic[8];  // "VRPROBE1"
+  uint64_t file_size;  // 0 for non-file urls, the cache is ignored when
+  int64_t file_mtime;  // the video file changes
+  int32_t stream_index;
+  int32_t codec_type;
+  int32_t codec_id;
+  uint32_t codec_tag;
+  int32_t format;
+  int32_t width;
+  int32_t height;
+  int32_t profile;
+  int32_t level;
+  int32_t field_order;
+  int32_t color_range;
+  int32_t color_primaries;
+  int32_t color_trc;
+  int32_t color_space;
+  int32_t chroma_location;
+  int32_t video_delay;
+  int32_t bits_per_coded_sample;
+  int32_t bits_per_raw_sample;
+  AVRational sample_aspect_ratio;
+  AVRational time_base;  // must match the demuxer
+  AVRational avg_frame_rate;
+  AVRational r_frame_rate;
+  int64_t bit_rate;
+  int64_t start_time;
+  int64_t duration;
+  int64_t nb_frames;
+  int64_t format_start_time;
+  int64_t format_duration;
+  uint32_t extradata_size;
+  uint32_t key_size;
+};
+static_assert(sizeof(ProbeCacheHeader) == 184, "unexpected padding");
+
+// cache file for `key` in `directory`
+std::string
+probe_cache_path(std::string const& directory, std::string const& key);
+
+// applies cached parameters to the opened `format_context` and returns
+// the video stream. nullptr when the cache is missing, stale or doesn't
+// match the streams the demuxer found
+AVStream* load_probe_cache(
+    std::string const& path,
+    std::string const& key,
+    uint64_t file_size,
+    int64_t file_mtime,
+    AVFormatContext* format_context);
+
+// atomically (write + rename) stores parameters of `av_stream`
+void save_probe_cache(
+    std::string const& path,
+    std::string const& key,
+    uint64_t file_size,
+    int64_t file_mtime,
+    AVFormatContext const* format_context,
+    AVStream const* av_stream);
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// "alignment" parameter: `VRImage::stride` is a multiple of it. Rows are
+// aligned in memory when the allocator aligns `VRImage::data` as well,
+// the default one aligns to 64 bytes
+int32_t const DEFAULT_ROW_ALIGNMENT = 16;
+int32_t const MAX_ROW_ALIGNMENT = 64;
+
+inline int32_t check_row_alignment(int64_t alignment) {
+  if (alignment <= 0 || alignment > MAX_ROW_ALIGNMENT ||
+      (alignment & (alignment - 1)) != 0) {
+    throw std::runtime_error(
+        "alignment must be a power of two up to " +
+        std::to_string(MAX_ROW_ALIGNMENT) + ", not " +
+        std::to_string(alignment));
+  }
+  return static_cast<int32_t>(alignment);
+}
+
+inline int32_t aligned_stride(int32_t row_bytes, int32_t alignment) {
+  return (row_bytes + alignment - 1) & ~(alignment - 1);
+}
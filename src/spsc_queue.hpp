@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Puts one thread to sleep until `ready()` is true. `wake` costs one atomic
+// load when the thread isn't parked, the mutex is only for sleeping
+class Parker {
+public:
+  template <typename Ready>
+  void park(Ready ready) {
+    this->parked.store(true);
+    if (!ready()) {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->cv.wait(lock, ready);
+    }
+    this->parked.store(false);
+  }
+
+  // call after changing what `ready` checks
+  void wake() {
+    if (this->parked.load()) {
+      {  // the parked thread is either before `ready()` or sleeping
+        std::lock_guard<std::mutex> guard(this->mutex);
+      }
+      this->cv.notify_one();
+    }
+  }
+
+private:
+  std::atomic<bool> parked{false};
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+// Preallocated lock-free queue for exactly one producer and one consumer
+template <typename T>
+class SPSCQueue {
+public:
+  explicit SPSCQueue(std::size_t capacity) {
+    std::size_t slots = 1;
+    while (slots < capacity) {
+      slots *= 2;
+    }
+    this->slots.resize(slots);
+    this->mask = slots - 1;
+  }
+
+  SPSCQueue(SPSCQueue const&) = delete;
+  SPSCQueue& operator=(SPSCQueue const&) = delete;
+
+  std::size_t capacity() const {
+    return this->slots.size();
+  }
+
+  // exact for the producer and the consumer when the other side is idle
+  std::size_t size() const {
+    return this->tail.load() - this->head.load();
+  }
+
+  bool empty() const {
+    return this->size() == 0;
+  }
+
+  // producer only
+  bool try_push(T const& value) {
+    std::size_t const tail = this->tail.load(std::memory_order_relaxed);
+    if (tail - this->head.load() == this->slots.size()) {
+      return false;
+    }
+    this->slots[tail & this->mask] = value;
+    this->tail.store(tail + 1);
+    return true;
+  }
+
+  // consumer only
+  bool try_pop(T& value) {
+    std::size_t const head = this->head.load(std::memory_order_relaxed);
+    if (head == this->tail.load()) {
+      return false;
+    }
+    value = this->slots[head & this->mask];
+    this->head.store(head + 1);
+    return true;
+  }
+
+private:
+  // sequentially consistent index updates pair with `Parker::park`
+  alignas(64) std::atomic<std::size_t> head{0};  // written by the consumer
+  alignas(64) std::atomic<std::size_t> tail{0};  // written by the producer
+  alignas(64) std::vector<T> slots;
+  std::size_t mask;
+};
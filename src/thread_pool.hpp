@@ -0,0 +1,116 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads for splitting one job into `size()` parts.
+// The calling thread works too, so `ThreadPool(1)` starts no threads
+class ThreadPool {
+public:
+  explicit ThreadPool(std::size_t threads) {
+    for (std::size_t idx = 1; idx < threads; ++idx) {
+      this->workers.emplace_back(&ThreadPool::work, this);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> guard(this->mutex);
+      this->stop_requested = true;
+    }
+    this->cv.notify_all();
+    for (auto& worker : this->workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(ThreadPool const&) = delete;
+  ThreadPool& operator=(ThreadPool const&) = delete;
+
+  std::size_t size() const {
+    return this->workers.size() + 1;
+  }
+
+  // calls `task(idx)` for every idx in [0, count) and waits for all of them.
+  // Rethrows the first exception. Not reentrant
+  void parallel_for(
+      std::size_t count, std::function<void(std::size_t)> const& task) {
+    if (count == 0) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(this->mutex);
+      this->task = &task;
+      this->count = count;
+      this->next.store(0);
+      this->running = this->workers.size();
+      this->exception = nullptr;
+      ++this->generation;
+    }
+    this->cv.notify_all();
+    this->run_tasks();
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->done_cv.wait(lock, [this] {
+      return this->running == 0;
+    });
+    this->task = nullptr;
+    if (this->exception) {
+      std::rethrow_exception(this->exception);
+    }
+  }
+
+private:
+  void run_tasks() {
+    std::size_t idx;
+    while ((idx = this->next.fetch_add(1)) < this->count) {
+      try {
+        (*this->task)(idx);
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        if (!this->exception) {
+          this->exception = std::current_exception();
+        }
+      }
+    }
+  }
+
+  void work() {
+    uint64_t seen_generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cv.wait(lock, [&] {
+          return this->stop_requested || this->generation != seen_generation;
+        });
+        if (this->stop_requested) {
+          return;
+        }
+        seen_generation = this->generation;
+      }
+      this->run_tasks();
+      {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        --this->running;
+      }
+      this->done_cv.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;  // guards everything below except `next`
+  std::condition_variable cv;  // new job or stop
+  std::condition_variable done_cv;  // a worker finished the job
+  std::function<void(std::size_t)> const* task = nullptr;
+  std::size_t count = 0;
+  std::atomic<std::size_t> next{0};
+  std::size_t running = 0;  // workers still in the current job
+  uint64_t generation = 0;
+  bool stop_requested = false;
+  std::exception_ptr exception;
+};
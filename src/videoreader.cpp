@@ -17,24 +17,20 @@
 #include "videoreader_idatum.hpp"
 #endif
 
+// recycles buffers, so that frames don't page-fault fresh memory
 static void default_vr_allocate(VideoReader::VRImage* image, void* unused) {
-  std::size_t const size = image->stride * image->height;
-  image->data = new (std::nothrow) uint8_t[size];
+  VideoReader::BufferPool::allocate(image, &VideoReader::BufferPool::shared());
 }
 
 static void default_vr_deallocate(VideoReader::VRImage* image, void* unused) {
-  delete[] static_cast<uint8_t*>(image->data);
-  image->data = nullptr;
+  VideoReader::BufferPool::deallocate(
+      image, &VideoReader::BufferPool::shared());
 }
 
-std::unique_ptr<VideoReader> VideoReader::create(
-    std::string const& url,
+static void _check_arguments(
     std::vector<std::string> const& parameter_pairs,
-    std::vector<std::string> const& extras,
-    AllocateCallback allocate_callback,
-    DeallocateCallback delallocate_callback,
-    LogCallback log_callback,
-    void* userdata) {
+    VideoReader::AllocateCallback& allocate_callback,
+    VideoReader::DeallocateCallback& delallocate_callback) {
   if (parameter_pairs.size() % 2 != 0) {
     throw std::runtime_error("invalid videoreader parameters size");
   }
@@ -44,6 +40,17 @@ std::unique_ptr<VideoReader> VideoReader::create(
   } else if (!(allocate_callback && delallocate_callback)) {
     throw std::runtime_error("all or no allocators MUST be specified");
   }
+}
+
+std::unique_ptr<VideoReader> VideoReader::create(
+    std::string const& url,
+    std::vector<std::string> const& parameter_pairs,
+    std::vector<std::string> const& extras,
+    AllocateCallback allocate_callback,
+    DeallocateCallback delallocate_callback,
+    LogCallback log_callback,
+    void* userdata) {
+  _check_arguments(parameter_pairs, allocate_callback, delallocate_callback);
 
 #ifdef VIDEOREADER_WITH_PYLON
   if (url.find("pylon://") == 0) {
@@ -100,10 +107,80 @@ std::unique_ptr<VideoReader> VideoReader::create(
 #endif
 }
 
+std::unique_ptr<VideoReader> VideoReader::create_from_memory(
+    uint8_t const* data,
+    std::size_t size,
+    std::vector<std::string> const& parameter_pairs,
+    std::vector<std::string> const& extras,
+    AllocateCallback allocate_callback,
+    DeallocateCallback delallocate_callback,
+    LogCallback log_callback,
+    void* userdata) {
+  _check_arguments(parameter_pairs, allocate_callback, delallocate_callback);
+#ifdef VIDEOREADER_WITH_FFMPEG
+  return std::unique_ptr<VideoReader>(new VideoReaderFFmpeg(
+      "",
+      parameter_pairs,
+      extras,
+      allocate_callback,
+      delallocate_callback,
+      log_callback,
+      userdata,
+      std::make_unique<MemoryIO>(data, size)));
+#else
+  throw std::runtime_error("memory input requires ffmpeg backend");
+#endif
+}
+
+std::unique_ptr<VideoReader> VideoReader::create_from_stream(
+    StreamCallbacks const& callbacks,
+    std::vector<std::string> const& parameter_pairs,
+    std::vector<std::string> const& extras,
+    AllocateCallback allocate_callback,
+    DeallocateCallback delallocate_callback,
+    LogCallback log_callback,
+    void* userdata) {
+  _check_arguments(parameter_pairs, allocate_callback, delallocate_callback);
+#ifdef VIDEOREADER_WITH_FFMPEG
+  return std::unique_ptr<VideoReader>(new VideoReaderFFmpeg(
+      "",
+      parameter_pairs,
+      extras,
+      allocate_callback,
+      delallocate_callback,
+      log_callback,
+      userdata,
+      std::make_unique<StreamIO>(callbacks)));
+#else
+  throw std::runtime_error("stream input requires ffmpeg backend");
+#endif
+}
+
 void VideoReader::set(std::vector<std::string> const& parameter_pairs) {
   throw std::runtime_error("not implemented");
 }
 
+void VideoReader::seek(Frame::number_t number) {
+  throw std::runtime_error("not implemented");
+}
+
+VideoReader::Frame::number_t VideoReader::seek_time(
+    Frame::timestamp_s_t timestamp_s) {
+  throw std::runtime_error("not implemented");
+}
+
+void VideoReader::reopen(std::string const& url) {
+  throw std::runtime_error("not implemented");
+}
+
+VideoReader::Batch VideoReader::next_frames(std::size_t n, bool decode) {
+  throw std::runtime_error("not implemented");
+}
+
+bool VideoReader::would_block() const {
+  return false;
+}
+
 VideoReader::Frame::~Frame() {
   if (this->free) {  // check that the frame wasn't moved
     (*this->free)(&this->image, this->userdata);
@@ -1,5 +1,8 @@
 #include <videoreader/videoreader.hpp>
 #include <videoreader/videowriter.hpp>
+#include <algorithm>  // std::copy
+#include <cstdlib>  // std::malloc
+#include <stdexcept>  // std::runtime_error
 
 #ifndef _MSC_VER
 #define API extern "C"
@@ -19,6 +22,7 @@ typedef struct {
   uint8_t* data;  // pointer to the first pixel
   void*
       user_data;  // user supplied data, useful for freeing in DeallocateCallback
+  int32_t pixel_format;
 } VRImage;
 
 static_assert(sizeof(VRImage) == sizeof(VideoReader::VRImage), "error");
@@ -29,6 +33,26 @@ API char const* videoreader_what(void) {
   return videoreader_what_str.c_str();
 }
 
+static std::vector<std::string> _to_strings(char const* argv[], int argc) {
+  std::vector<std::string> strings;
+  for (int idx{}; idx < argc; ++idx) {
+    strings.emplace_back(argv[idx]);
+  }
+  return strings;
+}
+
+static std::vector<std::string>
+_to_parameter_pairs(char const* argv[], int argc) {
+  std::vector<std::string> parameter_pairs = _to_strings(argv, argc);
+  for (std::size_t idx{}; idx < parameter_pairs.size(); idx += 2) {
+    // C API hands image ownership to the caller, shared frames can't be
+    if (parameter_pairs[idx] == "zero_copy") {
+      throw std::runtime_error("zero_copy is not supported in C API");
+    }
+  }
+  return parameter_pairs;
+}
+
 API int videoreader_create(
     struct videoreader** reader,
     char const* video_path,
@@ -41,18 +65,41 @@ API int videoreader_create(
     videoreader_log callback,
     void* userdata) {
   try {
-    std::vector<std::string> parameter_pairs;
-    for (int idx{}; idx < argc; ++idx) {
-      parameter_pairs.emplace_back(argv[idx]);
-    }
-    std::vector<std::string> extras_vec;
-    for (int idx{}; idx < extrasc; ++idx) {
-      extras_vec.emplace_back(extras[idx]);
-    }
     auto video_reader = VideoReader::create(
         video_path,
-        std::move(parameter_pairs),
-        std::move(extras_vec),
+        _to_parameter_pairs(argv, argc),
+        _to_strings(extras, extrasc),
+        reinterpret_cast<VideoReader::AllocateCallback>(alloc_callback),
+        reinterpret_cast<VideoReader::DeallocateCallback>(free_callback),
+        reinterpret_cast<VideoReader::LogCallback>(callback),
+        userdata);
+    *reader = reinterpret_cast<struct videoreader*>(video_reader.release());
+  } catch (std::exception& e) {
+    videoreader_what_str = e.what();
+    return -1;
+  }
+  return 0;
+}
+
+// `data` MUST outlive the reader
+API int videoreader_create_from_memory(
+    struct videoreader** reader,
+    uint8_t const* data,
+    uint64_t size,
+    char const* argv[],
+    int argc,
+    char const* extras[],
+    int extrasc,
+    videoreader_allocate alloc_callback,
+    videoreader_allocate free_callback,
+    videoreader_log callback,
+    void* userdata) {
+  try {
+    auto video_reader = VideoReader::create_from_memory(
+        data,
+        static_cast<std::size_t>(size),
+        _to_parameter_pairs(argv, argc),
+        _to_strings(extras, extrasc),
         reinterpret_cast<VideoReader::AllocateCallback>(alloc_callback),
         reinterpret_cast<VideoReader::DeallocateCallback>(free_callback),
         reinterpret_cast<VideoReader::LogCallback>(callback),
@@ -117,6 +164,7 @@ API int videoreader_next_frame(
     dst_img->stride = image.stride;
     dst_img->data = image.data;
     dst_img->user_data = image.user_data;
+    dst_img->pixel_format = static_cast<int32_t>(image.pixel_format);
 
     *number = frame->number;
     *timestamp_s = frame->timestamp_s;
@@ -131,6 +179,88 @@ API int videoreader_next_frame(
   return 0;
 }
 
+// numbers, timestamps_s: arrays of `n` items.
+// extras: `count` msgpack lists, MUST be freed with `free`
+API int videoreader_next_frames(
+    struct videoreader* reader,
+    uint64_t n,
+    VRImage* dst_img,
+    uint64_t* count,
+    int32_t* frame_height,
+    uint64_t* numbers,
+    double* timestamps_s,
+    unsigned char** extras,
+    unsigned int* extras_size,
+    bool decode) {
+  try {
+    VideoReader::Batch batch =
+        reinterpret_cast<VideoReader*>(reader)->next_frames(n, decode);
+    if (batch.count == 0) {
+      return 1;
+    }
+    auto const& image = batch.tensor->image;
+    dst_img->height = image.height;
+    dst_img->width = image.width;
+    dst_img->channels = image.channels;
+    dst_img->scalar_type = static_cast<int32_t>(image.scalar_type);
+    dst_img->stride = image.stride;
+    dst_img->data = image.data;
+    dst_img->user_data = image.user_data;
+    dst_img->pixel_format = static_cast<int32_t>(image.pixel_format);
+
+    *count = batch.count;
+    *frame_height = batch.frame_height;
+    std::copy(batch.numbers.begin(), batch.numbers.end(), numbers);
+    std::copy(
+        batch.timestamps_s.begin(), batch.timestamps_s.end(), timestamps_s);
+    *extras = nullptr;
+    *extras_size = static_cast<unsigned int>(batch.extras.size());
+    if (!batch.extras.empty()) {
+      *extras = static_cast<unsigned char*>(std::malloc(batch.extras.size()));
+      if (!*extras) {
+        throw std::runtime_error("out of memory");
+      }
+      std::copy(batch.extras.begin(), batch.extras.end(), *extras);
+    }
+    batch.tensor->free = nullptr;
+  } catch (std::exception& e) {
+    videoreader_what_str = e.what();
+    return -1;
+  }
+  return 0;
+}
+
+API int videoreader_seek(struct videoreader* reader, uint64_t number) {
+  try {
+    reinterpret_cast<VideoReader*>(reader)->seek(number);
+  } catch (std::exception& e) {
+    videoreader_what_str = e.what();
+    return -1;
+  }
+  return 0;
+}
+
+API int videoreader_seek_time(
+    struct videoreader* reader, double timestamp_s, uint64_t* number) {
+  try {
+    *number = reinterpret_cast<VideoReader*>(reader)->seek_time(timestamp_s);
+  } catch (std::exception& e) {
+    videoreader_what_str = e.what();
+    return -1;
+  }
+  return 0;
+}
+
+API int videoreader_reopen(struct videoreader* reader, char const* url) {
+  try {
+    reinterpret_cast<VideoReader*>(reader)->reopen(url);
+  } catch (std::exception& e) {
+    videoreader_what_str = e.what();
+    return -1;
+  }
+  return 0;
+}
+
 API int videoreader_size(struct videoreader* reader, uint64_t* count) {
   *count = reinterpret_cast<VideoReader*>(reader)->size();
   return 0;
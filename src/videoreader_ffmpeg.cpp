@@ -5,29 +5,51 @@
 //   * https://blogs.gentoo.org/lu_zero/2016/03/29/new-avcodec-api/
 //
 // Pitfalls (debugging requires a video for reproduction):
-//   * Calls `avcodec_receive_frame` only once, unlike docs are suggesting
+//   * Calls `avcodec_receive_frame` only once per packet, unlike docs are
+//     suggesting, and drains the decoder at the end of the stream
 //   * Doesn't support dynamic resolution change
 
 extern "C" {
 #include <libavdevice/avdevice.h>
 #include <libavformat/avio.h>  // needed?
 #include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>  // av_image_copy_plane
+#include <libavutil/pixdesc.h>
 }
+#include "color_convert.hpp"
 #include "ffmpeg_common.hpp"
-#include "spinlock.hpp"
+#include "ffmpeg_index.hpp"
+#include "ffmpeg_probe_cache.hpp"
+#include "row_alignment.hpp"
+#include "spsc_queue.hpp"
 #include "thismsgpack.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>  // std::max
 #include <atomic>
+#include <cmath>  // std::llround
 #include <condition_variable>
+#include <cstdio>  // std::sscanf
+#include <cstdlib>  // std::strtoul
+#include <cstring>  // std::memcmp
 #include <deque>
 #include <mutex>
 #include <stdexcept>  // std::runtime_error
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+// `AVIOInterruptCB` callback, aborts blocking reads once `stop` is called
+static int _interrupt_callback(void* stop_requested) {
+  return static_cast<std::atomic<bool> const*>(stop_requested)->load();
+}
+
+// io_context: custom source of bytes, `filename` is ignored then
 static AVFormatContextUP _get_format_context(
     std::string const& filename,
     AVDictionaryUP& options,
-    FFmpegLogInfo* opaque) {
+    FFmpegLogInfo* opaque,
+    AVIOContext* io_context,
+    std::atomic<bool> const* stop_requested) {
   AVInputFormat const* input_format = nullptr;
   std::string path_to_use = filename;
   std::size_t const protocol_idx = filename.find("://");
@@ -43,6 +65,13 @@ static AVFormatContextUP _get_format_context(
     throw std::runtime_error("Failed to allocate AVFormatContext");
   }
   format_context->opaque = opaque;
+  format_context->interrupt_callback = {
+      &_interrupt_callback, const_cast<std::atomic<bool>*>(stop_requested)};
+  if (io_context) {
+    format_context->pb = io_context;
+    format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+    path_to_use.clear();
+  }
 
   AVDictionary* opts = options.release();
 
@@ -119,7 +148,7 @@ struct DirtyHackFFStream {
 #endif
 };
 
-static AVStream* _get_video_stream(AVFormatContext* format_context) {
+static void _find_stream_info(AVFormatContext* format_context) {
   for (unsigned stream_idx = 0; stream_idx < format_context->nb_streams;
        ++stream_idx) {
     AVStream* stream = format_context->streams[stream_idx];
@@ -133,6 +162,37 @@ static AVStream* _get_video_stream(AVFormatContext* format_context) {
   if (avformat_find_stream_info(format_context, NULL) != 0) {
     throw std::runtime_error("avformat_find_stream_info failed");
   }
+}
+
+// video_stream: "first" video stream, "best" one by `av_find_best_stream`
+// heuristics or "N" - stream index in the container
+static AVStream* _get_video_stream(
+    AVFormatContext* format_context, std::string const& video_stream) {
+  if (video_stream == "best") {
+    int const stream_idx = av_find_best_stream(
+        format_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (stream_idx < 0) {
+      throw std::runtime_error("video steam not found");
+    }
+    return format_context->streams[stream_idx];
+  }
+  if (video_stream != "first") {
+    char* end = nullptr;
+    unsigned long const stream_idx =
+        std::strtoul(video_stream.c_str(), &end, 10);
+    if (video_stream.empty() || *end != '\0') {
+      throw std::runtime_error(
+          "invalid video_stream: `" + video_stream +
+          "`. Possible values are: 'first', 'best' or stream index");
+    }
+    if (stream_idx >= format_context->nb_streams ||
+        format_context->streams[stream_idx]->codecpar->codec_type !=
+            AVMEDIA_TYPE_VIDEO) {
+      throw std::runtime_error(
+          "stream " + video_stream + " is not a video stream");
+    }
+    return format_context->streams[stream_idx];
+  }
   for (unsigned stream_idx = 0; stream_idx < format_context->nb_streams;
        ++stream_idx) {
     AVStream* av_stream = format_context->streams[stream_idx];
@@ -143,16 +203,31 @@ static AVStream* _get_video_stream(AVFormatContext* format_context) {
   throw std::runtime_error("video steam not found");
 }
 
+// makes the demuxer skip packets of all streams except `stream_index`
+static void _discard_other_streams(
+    AVFormatContext* format_context, int stream_index) {
+  for (unsigned stream_idx = 0; stream_idx < format_context->nb_streams;
+       ++stream_idx) {
+    if (static_cast<int>(stream_idx) != stream_index) {
+      format_context->streams[stream_idx]->discard = AVDISCARD_ALL;
+    }
+  }
+}
+
 static AVCodecContextUP _get_codec_context(
     AVCodecParameters const* av_codecpar,
     AVDictionaryUP& options,
-    FFmpegLogInfo* opaque) {
+    FFmpegLogInfo* opaque,
+    int (*get_buffer2)(AVCodecContext*, AVFrame*, int) = nullptr) {
   AVCodec const* av_codec = avcodec_find_decoder(av_codecpar->codec_id);
   if (!av_codec) {
     throw std::runtime_error("Unsupported codec");
   }
   auto codec_context = AVCodecContextUP(avcodec_alloc_context3(av_codec));
   codec_context->opaque = opaque;
+  if (get_buffer2) {
+    codec_context->get_buffer2 = get_buffer2;
+  }
 
   if (avcodec_parameters_to_context(codec_context.get(), av_codecpar) != 0) {
     throw std::runtime_error("avcodec_parameters_to_context failed");
@@ -167,36 +242,219 @@ static AVCodecContextUP _get_codec_context(
   return codec_context;
 }
 
-static SwsContextUP _create_converter(
-    AVPixelFormat const pix_format, int const width, int const height) {
-  // hacks to avoid deprecated warning.
-  // must change `codec_context->color_range` somewhere
-  AVPixelFormat new_pix_format;
+static AVDictionaryUP _copy_dict(AVDictionaryUP const& dict) {
+  AVDictionary* copy = nullptr;
+  if (av_dict_copy(&copy, dict.get(), 0) < 0) {
+    av_dict_free(&copy);
+    throw std::runtime_error("failed to copy options");
+  }
+  return AVDictionaryUP(copy);
+}
+
+// `codec_context` can decode the stream of `codecpar` after a flush
+static bool _same_codec(
+    AVCodecContext const* codec_context, AVCodecParameters const* codecpar) {
+  return codec_context->codec_id == codecpar->codec_id &&
+         codec_context->width == codecpar->width &&
+         codec_context->height == codecpar->height &&
+         codec_context->pix_fmt == codecpar->format &&
+         codec_context->extradata_size == codecpar->extradata_size &&
+         (codecpar->extradata_size == 0 ||
+          std::memcmp(
+              codec_context->extradata,
+              codecpar->extradata,
+              codecpar->extradata_size) == 0);
+}
+
+static VideoReader::PIXEL_FORMAT
+_parse_pixel_format(std::string const& name) {
+  using PIXEL_FORMAT = VideoReader::PIXEL_FORMAT;
+  if (name == "rgb24") {
+    return PIXEL_FORMAT::RGB24;
+  }
+  if (name == "bgr24") {
+    return PIXEL_FORMAT::BGR24;
+  }
+  if (name == "rgba") {
+    return PIXEL_FORMAT::RGBA;
+  }
+  if (name == "gray8") {
+    return PIXEL_FORMAT::GRAY8;
+  }
+  if (name == "yuv420p") {
+    return PIXEL_FORMAT::YUV420P;
+  }
+  if (name == "nv12") {
+    return PIXEL_FORMAT::NV12;
+  }
+  throw std::runtime_error(
+      "unknown output_format: `" + name +
+      "`. Possible formats are: "
+      "'rgb24', 'bgr24', 'rgba', 'gray8', 'yuv420p', 'nv12'");
+}
+
+static int _parse_interpolation(std::string const& name) {
+  if (name == "nearest") {
+    return SWS_POINT;
+  }
+  if (name == "fast_bilinear") {
+    return SWS_FAST_BILINEAR;
+  }
+  if (name == "bilinear") {
+    return SWS_BILINEAR;
+  }
+  if (name == "bicubic") {
+    return SWS_BICUBIC;
+  }
+  if (name == "area") {
+    return SWS_AREA;
+  }
+  if (name == "lanczos") {
+    return SWS_LANCZOS;
+  }
+  throw std::runtime_error(
+      "unknown interpolation: `" + name +
+      "`. Possible interpolations are: "
+      "'nearest', 'fast_bilinear', 'bilinear', 'bicubic', 'area', 'lanczos'");
+}
+
+// "x,y,width,height"
+static void _parse_crop(std::string const& crop, int32_t rect[4]) {
+  char tail{};
+  if (std::sscanf(
+          crop.c_str(),
+          "%d,%d,%d,%d%c",
+          &rect[0],
+          &rect[1],
+          &rect[2],
+          &rect[3],
+          &tail) != 4 ||
+      rect[0] < 0 || rect[1] < 0 || rect[2] <= 0 || rect[3] <= 0) {
+    throw std::runtime_error(
+        "invalid crop: `" + crop + "`. Expected `x,y,width,height`");
+  }
+}
+
+static double _parse_target_fps(std::string const& target_fps) {
+  double fps{};
+  char tail{};
+  if (std::sscanf(target_fps.c_str(), "%lf%c", &fps, &tail) != 1 ||
+      !(fps > 0.0)) {
+    throw std::runtime_error("invalid target_fps: `" + target_fps + "`");
+  }
+  return fps;
+}
+
+static AVPixelFormat _to_av_pixel_format(VideoReader::PIXEL_FORMAT format) {
+  switch (format) {
+  case VideoReader::PIXEL_FORMAT::RGB24:
+    return AV_PIX_FMT_RGB24;
+  case VideoReader::PIXEL_FORMAT::BGR24:
+    return AV_PIX_FMT_BGR24;
+  case VideoReader::PIXEL_FORMAT::RGBA:
+    return AV_PIX_FMT_RGBA;
+  case VideoReader::PIXEL_FORMAT::GRAY8:
+    return AV_PIX_FMT_GRAY8;
+  case VideoReader::PIXEL_FORMAT::YUV420P:
+    return AV_PIX_FMT_YUV420P;
+  case VideoReader::PIXEL_FORMAT::NV12:
+    return AV_PIX_FMT_NV12;
+  }
+  throw std::runtime_error("invalid pixel format");
+}
+
+// planar YUV is a single channel image, see `VideoReader::PIXEL_FORMAT`
+static int32_t _get_channels(VideoReader::PIXEL_FORMAT format) {
+  switch (format) {
+  case VideoReader::PIXEL_FORMAT::RGB24:
+  case VideoReader::PIXEL_FORMAT::BGR24:
+    return 3;
+  case VideoReader::PIXEL_FORMAT::RGBA:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+static bool _is_yuv(VideoReader::PIXEL_FORMAT format) {
+  return format == VideoReader::PIXEL_FORMAT::YUV420P ||
+         format == VideoReader::PIXEL_FORMAT::NV12;
+}
+
+// rows of the luma plane, see `PIXEL_FORMAT`
+static int32_t _luma_height(VideoReader::VRImage const& image) {
+  return _is_yuv(image.pixel_format) ? image.height / 3 * 2 : image.height;
+}
+
+// `AV_PIX_FMT_YUVJ*` only differ in color range
+static AVPixelFormat _strip_jpeg_range(AVPixelFormat pix_format) {
   switch (pix_format) {
   case AV_PIX_FMT_YUVJ420P:
-    new_pix_format = AV_PIX_FMT_YUV420P;
-    break;
+    return AV_PIX_FMT_YUV420P;
   case AV_PIX_FMT_YUVJ422P:
-    new_pix_format = AV_PIX_FMT_YUV422P;
-    break;
+    return AV_PIX_FMT_YUV422P;
   case AV_PIX_FMT_YUVJ444P:
-    new_pix_format = AV_PIX_FMT_YUV444P;
-    break;
+    return AV_PIX_FMT_YUV444P;
   case AV_PIX_FMT_YUVJ440P:
-    new_pix_format = AV_PIX_FMT_YUV440P;
+    return AV_PIX_FMT_YUV440P;
+  default:
+    return pix_format;
+  }
+}
+
+// YUV formats with 8 bit luma in plane 0 can give GRAY8 without conversion
+static bool _has_luma_plane(AVPixelFormat pix_format) {
+  AVPixFmtDescriptor const* desc = av_pix_fmt_desc_get(pix_format);
+  return desc && desc->nb_components >= 3 &&
+         !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_HWACCEL)) &&
+         desc->comp[0].plane == 0 && desc->comp[0].step == 1 &&
+         desc->comp[0].depth == 8;
+}
+
+// plane pointers of `image` as described in `VideoReader::PIXEL_FORMAT`
+static void _fill_planes(
+    VideoReader::VRImage const& image,
+    int const luma_height,
+    uint8_t* data[4],
+    int linesize[4]) {
+  data[0] = image.data;
+  linesize[0] = image.stride;
+  uint8_t* const chroma = image.data + image.stride * luma_height;
+  switch (image.pixel_format) {
+  case VideoReader::PIXEL_FORMAT::YUV420P:
+    data[1] = chroma;
+    data[2] = chroma + image.stride / 2 * (luma_height / 2);
+    linesize[1] = linesize[2] = image.stride / 2;
+    break;
+  case VideoReader::PIXEL_FORMAT::NV12:
+    data[1] = chroma;
+    linesize[1] = image.stride;
     break;
   default:
-    new_pix_format = pix_format;
+    break;
   }
+}
+
+static SwsContextUP _create_converter(
+    AVPixelFormat const pix_format,
+    int const width,
+    int const height,
+    int const dst_width,
+    int const dst_height,
+    AVPixelFormat const dst_pix_format,
+    int const flags) {
+  // hacks to avoid deprecated warning.
+  // must change `codec_context->color_range` somewhere
+  AVPixelFormat const new_pix_format = _strip_jpeg_range(pix_format);
 
   SwsContextUP converter{sws_getContext(
       width,
       height,
       new_pix_format,
-      width,
-      height,
-      AV_PIX_FMT_RGB24,
-      SWS_BICUBIC,
+      dst_width,
+      dst_height,
+      dst_pix_format,
+      flags,
       nullptr,
       nullptr,
       nullptr)};
@@ -206,6 +464,158 @@ static SwsContextUP _create_converter(
   return converter;
 }
 
+// `AVCodecContext::opaque` for "zero_copy" decoding. Derives from
+// `FFmpegLogInfo`, so that `_av_log_callback` keeps working
+struct ZeroCopyAllocator : FFmpegLogInfo {
+  VideoReader::AllocateCallback allocate_callback;
+  VideoReader::DeallocateCallback deallocate_callback;
+  VideoReader::PIXEL_FORMAT output_format;
+
+  ZeroCopyAllocator(
+      FFmpegLogInfo const& log_info,
+      VideoReader::AllocateCallback allocate_callback,
+      VideoReader::DeallocateCallback deallocate_callback,
+      VideoReader::PIXEL_FORMAT output_format) :
+      FFmpegLogInfo{log_info},
+      allocate_callback{allocate_callback},
+      deallocate_callback{deallocate_callback},
+      output_format{output_format} {
+  }
+};
+
+// `AVBuffer` opaque, user memory is returned when the decoder
+// and all the frames stop referencing it
+struct ZeroCopyBuffer {
+  VideoReader::VRImage image;
+  VideoReader::DeallocateCallback deallocate_callback;
+  void* userdata;
+};
+
+static void _free_zero_copy_buffer(void* opaque, uint8_t* data) {
+  auto* const buffer = static_cast<ZeroCopyBuffer*>(opaque);
+  (*buffer->deallocate_callback)(&buffer->image, buffer->userdata);
+  delete buffer;
+}
+
+// `AVCodecContext::get_buffer2` that decodes into `AllocateCallback`
+// memory laid out as described in `VideoReader::PIXEL_FORMAT`.
+// Falls back to ffmpeg buffers when the layout can't be achieved
+static int _get_zero_copy_buffer(
+    AVCodecContext* codec_context, AVFrame* frame, int flags) {
+  using PIXEL_FORMAT = VideoReader::PIXEL_FORMAT;
+  auto const* allocator = static_cast<ZeroCopyAllocator const*>(
+      static_cast<FFmpegLogInfo*>(codec_context->opaque));
+  PIXEL_FORMAT const output_format = allocator->output_format;
+  AVPixelFormat const pix_format =
+      _strip_jpeg_range(static_cast<AVPixelFormat>(frame->format));
+  bool const is_nv12 = pix_format == AV_PIX_FMT_NV12;
+  bool const supported =
+      (codec_context->codec->capabilities & AV_CODEC_CAP_DR1) &&
+      (pix_format == AV_PIX_FMT_YUV420P || is_nv12) &&
+      (output_format == PIXEL_FORMAT::GRAY8 ||
+       _to_av_pixel_format(output_format) == pix_format);
+  if (!supported) {
+    return avcodec_default_get_buffer2(codec_context, frame, flags);
+  }
+  int width = frame->width;
+  int height = frame->height;
+  int linesize_align[AV_NUM_DATA_POINTERS]{};
+  avcodec_align_dimensions2(codec_context, &width, &height, linesize_align);
+  // decoders write whole macroblocks, so the chroma planes can only
+  // follow the visible luma rows when there are no padding rows
+  if (output_format != PIXEL_FORMAT::GRAY8 && height != frame->height) {
+    return avcodec_default_get_buffer2(codec_context, frame, flags);
+  }
+  int const alignment = 64;  // >= any `STRIDE_ALIGN`, for chroma as well
+  int const stride = (width + 2 * alignment - 1) & ~(2 * alignment - 1);
+  int const chroma_height = (height + 1) / 2;
+
+  auto* buffer = new ZeroCopyBuffer{
+      {
+          // extra row for decoders reading past the end
+          height + chroma_height + 1,  // height
+          stride,  // width
+          1,  // channels
+          VideoReader::SCALAR_TYPE::U8,  // scalar_type
+          stride,  // stride
+          nullptr,  // data
+          nullptr,  // user_data
+          output_format,  // pixel_format
+      },
+      allocator->deallocate_callback,
+      allocator->userdata};
+  VideoReader::VRImage& image = buffer->image;
+  (*allocator->allocate_callback)(&image, allocator->userdata);
+  if (!image.data) {
+    delete buffer;
+    return AVERROR(ENOMEM);
+  }
+  if (image.stride != stride ||
+      reinterpret_cast<uintptr_t>(image.data) % alignment != 0) {
+    // user allocator can't provide the memory decoder needs
+    _free_zero_copy_buffer(buffer, nullptr);
+    return avcodec_default_get_buffer2(codec_context, frame, flags);
+  }
+  std::size_t const size = static_cast<std::size_t>(stride) * image.height;
+  frame->buf[0] =
+      av_buffer_create(image.data, size, _free_zero_copy_buffer, buffer, 0);
+  if (!frame->buf[0]) {
+    _free_zero_copy_buffer(buffer, nullptr);
+    return AVERROR(ENOMEM);
+  }
+  uint8_t* const chroma =
+      image.data + static_cast<std::size_t>(stride) * height;
+  frame->data[0] = image.data;
+  frame->linesize[0] = stride;
+  frame->data[1] = chroma;
+  if (is_nv12) {
+    frame->linesize[1] = stride;
+  } else {
+    frame->linesize[1] = frame->linesize[2] = stride / 2;
+    frame->data[2] = chroma + stride / 2 * chroma_height;
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+// whether `av_frame` planes already are in `VideoReader::PIXEL_FORMAT`
+// layout, so the frame can be given to the user by reference
+static bool _can_share_frame(
+    AVFrame const* av_frame, VideoReader::PIXEL_FORMAT format) {
+  using PIXEL_FORMAT = VideoReader::PIXEL_FORMAT;
+  if (!av_frame->buf[0] || av_frame->linesize[0] <= 0) {
+    return false;
+  }
+  AVPixelFormat const pix_format =
+      _strip_jpeg_range(static_cast<AVPixelFormat>(av_frame->format));
+  uint8_t const* const chroma =
+      av_frame->data[0] +
+      static_cast<std::size_t>(av_frame->linesize[0]) * av_frame->height;
+  switch (format) {
+  case PIXEL_FORMAT::GRAY8:
+    return pix_format == AV_PIX_FMT_GRAY8 || _has_luma_plane(pix_format);
+  case PIXEL_FORMAT::YUV420P:
+    return pix_format == AV_PIX_FMT_YUV420P && av_frame->height % 2 == 0 &&
+           av_frame->data[1] == chroma &&
+           av_frame->linesize[1] * 2 == av_frame->linesize[0] &&
+           av_frame->linesize[2] == av_frame->linesize[1] &&
+           av_frame->data[2] ==
+               chroma + av_frame->linesize[1] * (av_frame->height / 2);
+  case PIXEL_FORMAT::NV12:
+    return pix_format == AV_PIX_FMT_NV12 && av_frame->height % 2 == 0 &&
+           av_frame->data[1] == chroma &&
+           av_frame->linesize[1] == av_frame->linesize[0];
+  default:
+    return pix_format == _to_av_pixel_format(format);
+  }
+}
+
+// `Frame::free` for shared frames, `userdata` is an `AVFrame` reference
+static void _free_shared_frame(VideoReader::VRImage*, void* userdata) {
+  AVFrame* av_frame = static_cast<AVFrame*>(userdata);
+  av_frame_free(&av_frame);
+}
+
 struct AVFramePusher {
   enum class Type { INT64_T, INT } _type;
   void* AVFrame::*ref;
@@ -244,20 +654,171 @@ struct AVFramePusher {
 //   }
 // }
 
+// per thread `convert_frame` state
+struct FrameConverter {
+  SwsContextUP sws_context;  // created on first use
+  // "conversion_threads": the frame is split into horizontal bands
+  std::unique_ptr<ThreadPool> pool;
+  std::vector<SwsContextUP> band_contexts;
+};
+
+// Decodes a seekable video with several threads, each with its own
+// AVFormatContext/AVCodecContext pair. The video is split at keyframes into
+// segments of whole GOPs, up to `window` consecutive segments are decoded
+// ahead and `next_frame` returns their frames in the original order.
+// Requires `PacketIndex`, frame numbers are presentation order indices.
+struct SegmentDecoder {
+  struct Segment {
+    VideoReader::Frame::number_t first_frame;  // presentation order
+    VideoReader::Frame::number_t end_frame;
+    int64_t keyframe_timestamp;  // decoding starts here
+    // timestamp of the last packet to send to the decoder, frames of the
+    // segment can be reordered after the next segment keyframe
+    int64_t last_packet_timestamp;
+    bool read_to_end;  // `last_packet_timestamp` is past the end
+  };
+  struct Output {
+    std::deque<VideoReader::FrameUP> frames;
+    bool done = false;
+  };
+
+  VideoReaderFFmpeg::Impl const* impl;
+  std::string const url;
+  std::vector<Segment> segments;
+  std::size_t const window;
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;  // guards everything below
+  std::condition_variable cv;
+  std::size_t current = 0;  // segment `next_frame` returns frames from
+  std::size_t next = 0;  // segment to hand to the next free worker
+  std::unordered_map<std::size_t, Output> outputs;
+  uint64_t generation = 0;  // incremented on seek, abandons segments in work
+  VideoReader::Frame::number_t skip_until = 0;  // seek target
+  bool stop_requested = false;
+  std::exception_ptr exception;
+
+  SegmentDecoder(
+      VideoReaderFFmpeg::Impl const* impl,
+      std::string const& url,
+      std::size_t workers);
+  ~SegmentDecoder();
+  void work() noexcept;
+  void decode_segment(
+      std::size_t segment_idx,
+      uint64_t generation,
+      AVFormatContext* format_context,
+      AVCodecContext* codec_context,
+      FrameConverter& converter);
+  VideoReader::FrameUP next_frame();
+  void seek(VideoReader::Frame::number_t number);
+};
+
+// special `read_queue` value; `nullptr` marks the end of the stream
+static AVPacket* const SEEK_DONE = reinterpret_cast<AVPacket*>(uintptr_t{2});
+// special `read_packet` value: "nonblocking" input has no packet yet
+static AVPacket* const WOULD_BLOCK = reinterpret_cast<AVPacket*>(uintptr_t{3});
+
+static bool _is_marker(AVPacket const* packet) {
+  return packet == nullptr || packet == SEEK_DONE;
+}
+
+struct QueuedPacket {
+  AVPacket* packet;
+  // realtime: packets `read` dropped right before this one, so that
+  // `Frame::number` accounts for the lost frames
+  std::size_t skipped;
+};
+
 struct VideoReaderFFmpeg::Impl {
   decltype(VideoReader::Frame::number) current_frame = 0;
   std::atomic<bool> stop_requested;
+  std::unique_ptr<CustomIO> io;  // outlives `format_context`
   AVFormatContextUP format_context;
   AVStream* av_stream;
+  std::unique_ptr<PacketIndex> index;  // optional, see `open_index`
+  std::unique_ptr<SegmentDecoder> segment_decoder;  // "segment_workers"
   AVCodecContextUP codec_context;
   AVFrameUP av_frame;
-  SwsContextUP sws_context;
+  FrameConverter converter;
+  PIXEL_FORMAT output_format;
+  int32_t crop[4]{};  // "crop": x, y, width, height. Zero size - no crop
+  // "output_width", "output_height", 0 - source size or keep aspect ratio
+  int32_t output_width = 0;
+  int32_t output_height = 0;
+  int sws_flags;  // "interpolation"
+  int32_t row_alignment;  // "alignment"
+  std::unique_ptr<ZeroCopyAllocator> zero_copy;  // "zero_copy"
+  // options `reopen` opens the next url with
+  AVDictionaryUP ffmpeg_options;  // format and codec options
+  std::string index_mode;  // "index"
+  std::size_t segment_workers = 0;  // "segment_workers"
+  std::string video_stream;  // "video_stream"
+  std::string probe_cache;  // "probe_cache" directory
+  std::string file_io;  // "file_io"
+  int64_t io_buffer_size = 0;  // "io_buffer_size"
+  // "every_n", "target_fps": frames the sampling doesn't select are skipped
+  // without conversion, non-reference ones aren't even decoded
+  int64_t every_n = 0;
+  double target_fps = 0.0;
+  int64_t last_sample = INT64_MIN;  // "target_fps" slot of the last frame
+  int64_t discard_before = INT64_MIN;  // `seek` target while seeking
+  // "keyframes_only": `read` drops other packets, the decoder discards
+  // whatever non-key frames slip through
+  bool keyframes_only = false;
 
   std::thread read_thread;  // for network to work
-  std::deque<AVPacket*> read_queue;  // read buffer
-  SpinLock read_queue_lock;
-  std::condition_variable_any cv;
+  bool inline_read = false;  // "read_thread": "0", `pop_packet` reads
+  bool nonblocking = false;  // "nonblocking", `read_packet` doesn't wait
+  bool blocked = false;  // the last `decode_next` ran out of input
+  std::unique_ptr<SPSCQueue<QueuedPacket>> read_queue;  // read buffer
+  // high watermarks, "read_queue_packets" and "read_queue_bytes". `read`
+  // waits for the queue to drain below 4/5 of both, `pop_packet` wakes it
+  std::size_t read_queue_packets;
+  std::size_t read_queue_bytes;
+  std::atomic<std::size_t> queued_bytes{0};  // payload of `read_queue`
+  int64_t realtime = -1;  // "realtime", -1 - decided by `is_realtime`
+  Parker read_parker;  // `read` waits for free space or a seek request
+  Parker packet_parker;  // `pop_packet` waits for packets
+  // realtime overflow handling. When a keyframe is queued, `read` asks
+  // the consumer to jump to the newest one, otherwise `read` drops
+  // packets until the next keyframe
+  std::atomic<bool> drop_requested{false};
+  std::atomic<uint64_t> newest_keyframe{0};  // `read_queue` position + 1
+  uint64_t pushed_packets = 0;  // `read` thread only
+  std::size_t skipped_packets = 0;  // `read` thread only
+  bool skip_to_keyframe = false;  // `read` thread only
+  uint64_t popped_packets = 0;  // consumer only
+  // consumer only, realtime dropped packets. Frames the decoder delayed
+  // from before the gap come out after it, so count by timestamps
+  bool realtime_gap = false;
+  bool stream_ended = false;  // consumer got the `nullptr` packet
+  bool draining = false;  // decoder was sent `nullptr`, returns delayed frames
+  bool try_push_packet(AVPacket* packet);
+  bool push_packet(AVPacket* packet);
   AVPacket* pop_packet();
+  ~Impl();
+
+  // "decode_ahead": `decode_thread` decodes and converts frames
+  // into `ready_frames` while the caller processes previous ones
+  std::size_t decode_ahead = 0;
+  std::thread decode_thread;  // started by `next_frame`, stopped by `seek`
+  std::mutex ready_mutex;  // guards everything below
+  std::condition_variable ready_cv;
+  std::deque<VideoReader::FrameUP> ready_frames;
+  bool decode_ended = false;  // `decode_thread` has nothing more to add
+  bool decode_pause_requested = false;
+  std::exception_ptr decode_exception;
+
+  std::atomic<bool> seek_requested;
+  // `reopen` waits until `read` pushes `SEEK_DONE` and pauses
+  std::atomic<bool> reopen_requested{false};
+  int64_t seek_timestamp;  // in `av_stream->time_base` units
+  int seek_ret;  // `av_seek_frame` result, valid after `SEEK_DONE`
+  // `av_frame` is the next frame: the result of the last seek or the frame
+  // that didn't fit in the last batch
+  bool frame_pending = false;
+  VideoReader::FrameUP batch_pending;  // ready frame that didn't fit
 
   std::vector<AVFramePusher> pushers;
   AllocateCallback allocate_callback;
@@ -271,8 +832,11 @@ struct VideoReaderFFmpeg::Impl {
       AllocateCallback allocate_callback,
       DeallocateCallback deallocate_callback,
       VideoReader::LogCallback log_callback,
-      void* userdata) :
+      void* userdata,
+      std::unique_ptr<CustomIO> io) :
       stop_requested(false),
+      io{std::move(io)},
+      seek_requested(false),
       allocate_callback{allocate_callback},
       deallocate_callback{deallocate_callback},
       log_info{log_callback, userdata, 1} {
@@ -298,17 +862,101 @@ struct VideoReaderFFmpeg::Impl {
       }
     }
     AVDictionaryUP options = _create_dict_from_params_vec(parameter_pairs);
-    this->format_context = _get_format_context(url, options, &this->log_info);
-    this->av_stream = _get_video_stream(format_context.get());
-    this->codec_context =
-        _get_codec_context(av_stream->codecpar, options, &this->log_info);
-    this->av_frame = AVFrameUP(av_frame_alloc());
-    if (this->codec_context->pix_fmt != AV_PIX_FMT_NONE) {
-      this->sws_context = _create_converter(
-          this->codec_context->pix_fmt,
-          this->codec_context->width,
-          this->codec_context->height);
+    this->index_mode = pop_value_string(options, "index", "0");
+    int64_t const segment_workers =
+        pop_value_int64(options, "segment_workers", 0);
+    if (segment_workers > 1) {
+      this->segment_workers = static_cast<std::size_t>(segment_workers);
+    }
+    this->output_format = _parse_pixel_format(
+        pop_value_string(options, "output_format", "rgb24"));
+    std::string const crop = pop_value_string(options, "crop", "");
+    if (!crop.empty()) {
+      _parse_crop(crop, this->crop);
+    }
+    int64_t const output_width = pop_value_int64(options, "output_width", 0);
+    int64_t const output_height = pop_value_int64(options, "output_height", 0);
+    if (output_width < 0 || output_height < 0 || output_width > INT32_MAX ||
+        output_height > INT32_MAX) {
+      throw std::runtime_error("invalid output size");
+    }
+    this->output_width = static_cast<int32_t>(output_width);
+    this->output_height = static_cast<int32_t>(output_height);
+    this->sws_flags = _parse_interpolation(
+        pop_value_string(options, "interpolation", "bicubic"));
+    this->row_alignment = check_row_alignment(
+        pop_value_int64(options, "alignment", DEFAULT_ROW_ALIGNMENT));
+    int64_t const read_queue_packets =
+        pop_value_int64(options, "read_queue_packets", 100);
+    int64_t const read_queue_bytes =
+        pop_value_int64(options, "read_queue_bytes", int64_t{64} << 20);
+    if (read_queue_packets <= 0 || read_queue_bytes <= 0) {
+      throw std::runtime_error("read_queue limits must be positive");
     }
+    this->read_queue_packets = static_cast<std::size_t>(read_queue_packets);
+    this->read_queue_bytes = static_cast<std::size_t>(read_queue_bytes);
+    // `read` can add one packet over the limit, plus `SEEK_DONE` and `nullptr`
+    this->read_queue = std::make_unique<SPSCQueue<QueuedPacket>>(
+        this->read_queue_packets + 3);
+    this->realtime = pop_value_int64(options, "realtime", -1);
+    this->inline_read = pop_value_int64(options, "read_thread", 1) == 0;
+    int64_t const decode_ahead = pop_value_int64(options, "decode_ahead", 0);
+    if (decode_ahead > 0) {
+      this->decode_ahead = static_cast<std::size_t>(decode_ahead);
+    }
+    this->nonblocking = pop_value_int64(options, "nonblocking", 0) != 0;
+    if (this->nonblocking &&
+        (!this->inline_read || this->decode_ahead || this->segment_workers)) {
+      throw std::runtime_error(
+          "nonblocking requires read_thread 0 and can't be used with "
+          "decode_ahead or segment_workers");
+    }
+    int64_t const every_n = pop_value_int64(options, "every_n", 0);
+    if (every_n < 0) {
+      throw std::runtime_error("every_n must not be negative");
+    }
+    this->every_n = every_n;
+    std::string const target_fps = pop_value_string(options, "target_fps", "");
+    if (!target_fps.empty()) {
+      this->target_fps = _parse_target_fps(target_fps);
+    }
+    if (this->every_n > 1 && this->target_fps > 0.0) {
+      throw std::runtime_error("every_n and target_fps are exclusive");
+    }
+    this->keyframes_only = pop_value_int64(options, "keyframes_only", 0) != 0;
+    int64_t const conversion_threads =
+        pop_value_int64(options, "conversion_threads", 1);
+    if (conversion_threads > 1) {
+      this->converter.pool = std::make_unique<ThreadPool>(
+          static_cast<std::size_t>(conversion_threads));
+    }
+    if (pop_value_int64(options, "zero_copy", 0)) {
+      this->zero_copy = std::make_unique<ZeroCopyAllocator>(
+          this->log_info,
+          allocate_callback,
+          deallocate_callback,
+          this->output_format);
+    }
+    this->video_stream = pop_value_string(options, "video_stream", "first");
+    this->probe_cache = pop_value_string(options, "probe_cache", "");
+    std::string const probe_cache_key =
+        pop_value_string(options, "probe_cache_key", "");
+    this->file_io = pop_value_string(options, "file_io", "ffmpeg");
+    this->io_buffer_size = pop_value_int64(options, "io_buffer_size", 0);
+    if (!this->io) {
+      this->io = open_file_io(url, this->file_io, this->io_buffer_size);
+    } else if (this->file_io != "ffmpeg") {
+      throw std::runtime_error("file_io requires a url");
+    }
+    this->ffmpeg_options = _copy_dict(options);
+    this->format_context = this->open_input(
+        url, this->io.get(), probe_cache_key, options, &this->av_stream);
+    if (this->index_mode != "0") {
+      this->open_index(url, this->index_mode);
+    }
+    this->codec_context = this->open_codec(this->av_stream, options);
+    this->av_frame = AVFrameUP(av_frame_alloc());
+    this->init_converter();
 
     if (options) {
       char* buf = NULL;
@@ -320,76 +968,478 @@ struct VideoReaderFFmpeg::Impl {
       throw std::runtime_error("unknown options: " + options);
     }
 
-    this->read_thread = std::thread(&VideoReaderFFmpeg::Impl::read, this);
+    if (this->is_sampling() || this->keyframes_only) {
+      if (segment_workers > 1) {
+        throw std::runtime_error(
+            "every_n, target_fps and keyframes_only can't be used with "
+            "segment_workers");
+      }
+      if (!this->index) {
+        this->frame_rate();  // frame numbers come from timestamps
+      }
+    }
+    if (this->segment_workers) {
+      this->start_segment_decoder(url);
+    } else if (this->inline_read) {
+      this->rewind();
+    } else {
+      this->read_thread = std::thread(&VideoReaderFFmpeg::Impl::read, this);
+    }
+  }
+
+  void start_segment_decoder(std::string const& url) {
+    if (!this->is_seekable()) {
+      throw std::runtime_error("segment_workers requires a seekable video");
+    }
+    if (this->io && !this->io->clone()) {
+      throw std::runtime_error(
+          "segment_workers requires a url or memory input");
+    }
+    if (!this->index) {
+      this->open_index(url, "memory");
+    }
+    this->segment_decoder =
+        std::make_unique<SegmentDecoder>(this, url, this->segment_workers);
+  }
+
+  // opens `url` (or `io`) and finds the video stream
+  AVFormatContextUP open_input(
+      std::string const& url,
+      CustomIO const* io,
+      std::string const& probe_cache_key,
+      AVDictionaryUP& options,
+      AVStream** av_stream) {
+    AVFormatContextUP format_context = _get_format_context(
+        url,
+        options,
+        &this->log_info,
+        io ? io->context() : nullptr,
+        &this->stop_requested);
+    *av_stream =
+        this->probe_video_stream(format_context.get(), url, probe_cache_key);
+    _discard_other_streams(format_context.get(), (*av_stream)->index);
+    if (this->nonblocking) {  // probing above needs the data anyway
+      format_context->flags |= AVFMT_FLAG_NONBLOCK;
+    }
+    return format_context;
+  }
+
+  AVCodecContextUP
+  open_codec(AVStream const* av_stream, AVDictionaryUP& options) {
+    AVCodecContextUP codec_context;
+    if (this->zero_copy) {
+      codec_context = _get_codec_context(
+          av_stream->codecpar,
+          options,
+          this->zero_copy.get(),
+          _get_zero_copy_buffer);
+    } else {
+      codec_context =
+          _get_codec_context(av_stream->codecpar, options, &this->log_info);
+    }
+    codec_context->skip_frame = this->default_discard();
+    return codec_context;
+  }
+
+  // (re)creates `converter` contexts for `codec_context`
+  void init_converter() {
+    this->converter.sws_context.reset();
+    this->converter.band_contexts.clear();
+    if (this->codec_context->pix_fmt != AV_PIX_FMT_NONE) {
+      int32_t width{}, height{};
+      this->output_size(&width, &height);
+      this->converter.sws_context = _create_converter(
+          this->codec_context->pix_fmt,
+          this->source_width(),
+          this->source_height(),
+          width,
+          height,
+          _to_av_pixel_format(this->output_format),
+          this->sws_flags);
+    }
+  }
+
+  // Replaces the demuxer with one of `url`. The new input is opened
+  // before the current one is touched, so on failure the reader keeps
+  // reading the old one. `read_thread`, `read_queue` and the allocator
+  // are reused, and the decoder too when the codec parameters match
+  void reopen(std::string const& url) {
+    AVDictionaryUP options = _copy_dict(this->ffmpeg_options);
+    std::unique_ptr<CustomIO> io =
+        open_file_io(url, this->file_io, this->io_buffer_size);
+    AVStream* av_stream = nullptr;
+    AVFormatContextUP format_context =
+        this->open_input(url, io.get(), "", options, &av_stream);
+    if (this->segment_workers &&
+        !(format_context->pb && format_context->pb->seekable)) {
+      throw std::runtime_error("segment_workers requires a seekable video");
+    }
+    AVCodecContextUP codec_context;
+    if (!_same_codec(this->codec_context.get(), av_stream->codecpar)) {
+      codec_context = this->open_codec(av_stream, options);
+    }
+
+    if (this->segment_decoder) {
+      this->segment_decoder.reset();  // joins the workers
+    } else {
+      if (this->decode_thread.joinable()) {  // restarted by `next_frame`
+        this->stop_decode_thread();
+      }
+      if (!this->inline_read) {
+        this->reopen_requested = true;
+        this->read_parker.wake();
+        if (!this->drop_packets_until_seek_done()) {
+          return;  // stopped
+        }
+      }
+    }
+    // `read` is paused, the old demuxer is destroyed with the locals
+    std::swap(this->io, io);
+    std::swap(this->format_context, format_context);
+    this->av_stream = av_stream;
+    if (codec_context) {
+      std::swap(this->codec_context, codec_context);
+      this->init_converter();
+    } else {
+      avcodec_flush_buffers(this->codec_context.get());
+    }
+    this->index.reset();
+    this->current_frame = 0;
+    this->stream_ended = false;
+    this->draining = false;
+    this->realtime_gap = false;
+    this->frame_pending = false;
+    this->batch_pending.reset();
+    this->last_sample = INT64_MIN;
+    this->discard_before = INT64_MIN;
+    this->drop_requested = false;
+    try {
+      // an explicit sidecar path belongs to the previous video
+      if (this->index_mode != "0") {
+        this->open_index(
+            url, this->index_mode == "1" ? this->index_mode : "memory");
+      }
+      if ((this->is_sampling() || this->keyframes_only) && !this->index) {
+        this->frame_rate();  // frame numbers come from timestamps
+      }
+      if (this->segment_workers) {
+        this->start_segment_decoder(url);
+      } else if (this->inline_read) {
+        this->rewind();
+      }
+    } catch (...) {
+      this->reopen_requested = false;
+      this->read_parker.wake();
+      throw;
+    }
+    this->reopen_requested = false;
+    this->read_parker.wake();
   }
   bool is_seekable() const {
     AVIOContext const* io_centext = this->format_context->pb;
     return io_centext && io_centext->seekable != 0;
   }
 
-  void read() {
+  // realtime sources drop packets instead of waiting for the consumer.
+  // Unless "realtime" is set, custom io is never realtime, even when it
+  // can't seek
+  bool is_realtime() const {
+    if (this->realtime >= 0) {
+      return this->realtime != 0;
+    }
+    return !this->io && !this->is_seekable();
+  }
+
+  void log(std::string const& message, VideoReader::LogLevel level) const {
+    if (this->log_info.log_callback) {
+      this->log_info.log_callback(
+          message.c_str(), level, this->log_info.userdata);
+    }
+  }
+
+  // mode: "1" - sidecar next to the video file,
+  //       "memory" - don't use sidecar file,
+  //       any other value - sidecar file path
+  // `_get_video_stream` that skips `avformat_find_stream_info` when
+  // "probe_cache" has parameters from a previous open of `url`
+  // (or of `cache_key`, when set)
+  AVStream* probe_video_stream(
+      AVFormatContext* format_context,
+      std::string const& url,
+      std::string const& cache_key) {
+    std::string const& video_stream = this->video_stream;
+    std::string const& cache_directory = this->probe_cache;
+    if (cache_directory.empty()) {
+      _find_stream_info(format_context);
+      return _get_video_stream(format_context, video_stream);
+    }
+    uint64_t file_size{};
+    int64_t file_mtime{};
+    std::string key = cache_key;
+    if (key.empty()) {
+      if (url.empty()) {
+        throw std::runtime_error("probe_cache requires a url or a key");
+      }
+      std::string const local_path = get_local_path(url);
+      if (!local_path.empty()) {
+        get_file_key(local_path, &file_size, &file_mtime);
+      }
+      key = url;
+    }
+    key += '\n' + video_stream;
+    std::string const cache_path = probe_cache_path(cache_directory, key);
+    if (AVStream* const av_stream = load_probe_cache(
+            cache_path, key, file_size, file_mtime, format_context)) {
+      this->log(
+          "probe_cache: hit `" + cache_path + "`",
+          VideoReader::LogLevel::DEBUG);
+      return av_stream;
+    }
+    this->log(
+        "probe_cache: miss `" + cache_path + "`", VideoReader::LogLevel::DEBUG);
+    _find_stream_info(format_context);
+    AVStream* const av_stream =
+        _get_video_stream(format_context, video_stream);
+    try {
+      save_probe_cache(
+          cache_path, key, file_size, file_mtime, format_context, av_stream);
+    } catch (std::exception const& e) {
+      this->log(e.what(), VideoReader::LogLevel::WARNING);
+    }
+    return av_stream;
+  }
+
+  void open_index(std::string const& url, std::string const& mode) {
+    if (!this->is_seekable()) {
+      throw std::runtime_error("index requires a seekable video");
+    }
+    std::string const local_path = get_local_path(url);
+    std::string index_path;
+    if (mode == "1") {
+      if (local_path.empty()) {
+        throw std::runtime_error(
+            "index sidecar requires a local file, set index path explicitly "
+            "or use `memory` index");
+      }
+      index_path = local_path + ".vrindex";
+    } else if (mode != "memory") {
+      index_path = mode;
+    }
+    uint64_t file_size{};
+    int64_t file_mtime{};
+    bool has_key = true;
+    if (!index_path.empty()) {
+      if (local_path.empty()) {
+        has_key = get_stream_key(
+            this->format_context.get(),
+            this->av_stream,
+            &file_size,
+            &file_mtime);
+        this->rewind();
+      } else {
+        has_key = get_file_key(local_path, &file_size, &file_mtime);
+      }
+    }
+    if (!has_key) {
+      // a stale sidecar would give wrong counts and seek targets
+      this->log(
+          "can't detect changes of `" + url + "`, index is not stored",
+          VideoReader::LogLevel::WARNING);
+      index_path.clear();
+    }
+    if (!index_path.empty()) {
+      this->index = PacketIndex::load(
+          index_path, file_size, file_mtime, this->av_stream->index);
+      if (this->index) {
+        return;
+      }
+    }
+    this->index =
+        PacketIndex::build(this->format_context.get(), this->av_stream);
+    // `read` seeks to the beginning of the file
+    if (!index_path.empty()) {
+      try {
+        this->index->save(
+            index_path, file_size, file_mtime, this->av_stream->index);
+      } catch (std::exception const& e) {
+        this->log(e.what(), VideoReader::LogLevel::WARNING);
+      }
+    }
+  }
+
+  void rewind() {
     if (this->is_seekable()) {
       // seeking to timestemp 0.0 helps prevent compression
       // artifacts on broken videos. `av_seek_frame` is known to hang
       // on streamed videos, so check `is_seekable` first
       av_seek_frame(this->format_context.get(), -1, 0, AVSEEK_FLAG_ANY);
     }
+  }
+
+  // to `seek_timestamp`, the result is in `seek_ret`
+  void seek_demuxer() {
+    this->seek_ret = av_seek_frame(
+        this->format_context.get(),
+        this->av_stream->index,
+        this->seek_timestamp,
+        AVSEEK_FLAG_BACKWARD);
+  }
+
+  // "read_thread": "0" - `pop_packet` without `read_thread`. Returns the
+  // next video packet, `WOULD_BLOCK` or nullptr at the end
+  AVPacket* read_packet() {
     while (!this->stop_requested) {
+      AVPacketUP packet(av_packet_alloc());
+      int const read_ret =
+          av_read_frame(this->format_context.get(), packet.get());
+      if (read_ret == AVERROR(EAGAIN) && this->nonblocking) {
+        return WOULD_BLOCK;
+      }
+      if (read_ret < 0) {
+        return nullptr;
+      }
+      if (packet->stream_index != this->av_stream->index) {
+        // a stream that appeared after opening, e.g. in mpegts
+        _discard_other_streams(
+            this->format_context.get(), this->av_stream->index);
+      } else if (!this->keyframes_only || (packet->flags & AV_PKT_FLAG_KEY)) {
+        return packet.release();
+      }
+    }
+    return nullptr;
+  }
+
+  void read() {
+    this->rewind();
+    while (!this->stop_requested) {
+      if (this->reopen_requested) {  // `reopen` replaces the demuxer
+        this->push_packet(SEEK_DONE);
+        this->read_parker.park([&] {
+          return !this->reopen_requested || this->stop_requested;
+        });
+        this->skipped_packets = 0;
+        this->skip_to_keyframe = false;
+        this->rewind();
+        continue;
+      }
+      if (this->seek_requested) {
+        this->seek_demuxer();
+        this->seek_requested = false;
+        this->push_packet(SEEK_DONE);
+      }
       AVPacketUP thread_packet(av_packet_alloc());
       int const read_ret =
           av_read_frame(this->format_context.get(), thread_packet.get());
-      if (read_ret < 0) {  // error occurred
-        {  // unrecoverable error. exit the thread
-          std::lock_guard<SpinLock> guard(this->read_queue_lock);
-          this->read_queue.push_back(nullptr);
-        }
-        this->cv.notify_one();
-        return;
+      if (read_ret < 0) {  // the end of the file or unrecoverable error
+        this->push_packet(nullptr);
+        // wait for a seek request (offline) or a new url
+        this->read_parker.park([&] {
+          return this->seek_requested || this->reopen_requested ||
+                 this->stop_requested;
+        });
+        continue;
       }
       if (thread_packet->stream_index == this->av_stream->index) {
-        this->read_queue_lock.lock();
-        if (this->read_queue.size() > 100) {
-          if (this->is_seekable()) {  // offline - wait for data
-            this->read_queue_lock.unlock();
-            while (!this->stop_requested) {
-              std::this_thread::sleep_for(std::chrono::milliseconds(100));
-              {
-                std::lock_guard<SpinLock> guard(this->read_queue_lock);
-                if (this->read_queue.size() < 80) {
-                  break;
-                }
-              }
-            }
-            this->read_queue_lock.lock();  // lock here for easier unlock logic
-          } else {  // realtime - clear buffer
-            for (int i = 0; i < 90; ++i) {
-              this->read_queue.pop_front();
+        bool const is_keyframe = thread_packet->flags & AV_PKT_FLAG_KEY;
+        if (this->keyframes_only && !is_keyframe) {
+          continue;
+        }
+        if (this->read_queue_full()) {
+          if (!this->is_realtime()) {  // offline - wait for data
+            this->read_parker.park([&] {
+              return this->stop_requested || this->seek_requested ||
+                     this->reopen_requested || this->read_queue_drained();
+            });
+          } else if (!this->skip_to_keyframe) {  // realtime - clear buffer
+            uint64_t const first_queued =
+                this->pushed_packets - this->read_queue->size();
+            if (this->newest_keyframe > first_queued + 1) {
+              this->drop_requested = true;
+            } else {  // a partial GOP can't be decoded, drop the rest of it
+              this->skip_to_keyframe = true;
             }
           }
         }
-        this->read_queue_lock.unlock();
-        {
-          std::lock_guard<SpinLock> guard(this->read_queue_lock);
-          this->read_queue.push_back(thread_packet.release());
+        if ((this->skip_to_keyframe && !is_keyframe) ||
+            !this->try_push_packet(thread_packet.get())) {
+          // realtime and the consumer is stuck, or the GOP is broken
+          this->skip_to_keyframe = true;
+          ++this->skipped_packets;
+          continue;
         }
-        this->cv.notify_one();
+        thread_packet.release();
+        this->skip_to_keyframe = false;
+      } else {  // a stream that appeared after opening, e.g. in mpegts
+        _discard_other_streams(
+            this->format_context.get(), this->av_stream->index);
       }
     }
   }
 
-  VideoReader::FrameUP next_frame(bool decode) {
-    while (!this->stop_requested) {
+  // drops packets read before the `SEEK_DONE` marker. False when stopped
+  bool drop_packets_until_seek_done() {
+    while (true) {
       AVPacket* raw_packet = this->pop_packet();
-      if (reinterpret_cast<uintptr_t>(raw_packet) <= 1) {
-        if (raw_packet == nullptr) {
-          std::lock_guard<SpinLock> guard(this->read_queue_lock);
-          this->read_queue.emplace_back(
-              reinterpret_cast<AVPacket*>(uintptr_t{1}));
+      if (raw_packet == SEEK_DONE) {
+        return true;
+      }
+      if (this->stop_requested) {
+        return false;
+      }
+      if (raw_packet != nullptr) {
+        av_packet_free(&raw_packet);
+      }
+    }
+  }
+
+  bool read_queue_full() const {
+    return this->read_queue->size() > this->read_queue_packets ||
+           this->queued_bytes > this->read_queue_bytes;
+  }
+
+  bool read_queue_drained() const {
+    return this->read_queue->size() <
+               this->read_queue_packets - this->read_queue_packets / 5 &&
+           this->queued_bytes <
+               this->read_queue_bytes - this->read_queue_bytes / 5;
+  }
+
+  // decodes the next frame into `av_frame`. Returns false at the end,
+  // and with `blocked` set when "nonblocking" input has no packet yet
+  bool decode_next() {
+    if (this->stream_ended) {
+      throw std::runtime_error("second call on ended stream");
+    }
+    this->blocked = false;
+    while (!this->stop_requested) {
+      if (this->draining) {
+        int const receive_ret = avcodec_receive_frame(
+            this->codec_context.get(), this->av_frame.get());
+        if (receive_ret != 0) {  // AVERROR_EOF, all frames returned
+          this->draining = false;
+          this->stream_ended = true;
           break;
         }
-        throw std::runtime_error("second call on ended stream");
+        this->apply_crop(this->av_frame.get());
+        return true;
+      }
+      AVPacket* raw_packet = this->pop_packet();
+      if (raw_packet == SEEK_DONE) {
+        continue;
+      }
+      if (raw_packet == WOULD_BLOCK) {
+        this->blocked = true;
+        return false;
+      }
+      if (raw_packet == nullptr) {
+        // frames of reordered (B-frame) packets are still in the decoder
+        avcodec_send_packet(this->codec_context.get(), nullptr);
+        this->draining = true;
+        continue;
       }
       AVPacketUP local_packet(raw_packet);
+      this->codec_context->skip_frame =
+          this->packet_discard(local_packet.get());
       int const send_ret =
           avcodec_send_packet(this->codec_context.get(), local_packet.get());
       if (send_ret != 0) {
@@ -397,84 +1447,983 @@ struct VideoReaderFFmpeg::Impl {
         this->current_frame++;
         continue;
       }
-      //while (true)
-      {
-        int const receive_ret = avcodec_receive_frame(
-            this->codec_context.get(), this->av_frame.get());
-        if (receive_ret == AVERROR(EAGAIN)) {
-          continue;
-        }
-        if (receive_ret != 0) {
-          throw std::runtime_error(
-              "avcodec_receive_frame failed " + get_av_error(receive_ret));
+      int const receive_ret = avcodec_receive_frame(
+          this->codec_context.get(), this->av_frame.get());
+      if (receive_ret == AVERROR(EAGAIN)) {
+        continue;
+      }
+      if (receive_ret != 0) {
+        throw std::runtime_error(
+            "avcodec_receive_frame failed " + get_av_error(receive_ret));
+      }
+      this->apply_crop(this->av_frame.get());
+      return true;
+    }  // while (true)
+    return false;
+  }
+
+  VideoReader::FrameUP next_frame(bool decode) {
+    if (this->batch_pending) {
+      return std::move(this->batch_pending);
+    }
+    if (this->segment_decoder) {
+      return this->segment_decoder->next_frame();
+    }
+    if (this->decode_ahead) {
+      if (!this->decode_thread.joinable()) {
+        this->decode_thread =
+            std::thread(&VideoReaderFFmpeg::Impl::decode, this);
+      }
+      return this->pop_ready_frame();
+    }
+    return this->decode_frame(decode);
+  }
+
+  AVDiscard default_discard() const {
+    return this->keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+  }
+
+  bool is_sampling() const {
+    return this->every_n > 1 || this->target_fps > 0.0;
+  }
+
+  // "target_fps" interval of `timestamp`
+  int64_t sample_slot(int64_t timestamp) const {
+    double const seconds = (timestamp - this->start_timestamp()) *
+                           av_q2d(this->av_stream->time_base);
+    return static_cast<int64_t>(std::floor(seconds * this->target_fps));
+  }
+
+  bool is_selected(Frame::number_t number, int64_t timestamp) const {
+    if (this->every_n > 1) {
+      return number % static_cast<Frame::number_t>(this->every_n) == 0;
+    }
+    if (this->target_fps > 0.0 && timestamp != AV_NOPTS_VALUE) {
+      return this->sample_slot(timestamp) > this->last_sample;
+    }
+    return true;
+  }
+
+  // decoder `skip_frame` for `packet`. Frames that won't be returned
+  // are guessed from the packet pts. Reference frames are decoded anyway,
+  // `seek` and `decode_selected` drop them
+  AVDiscard packet_discard(AVPacket const* packet) const {
+    AVDiscard const discard = this->default_discard();
+    int64_t const pts = packet->pts;
+    if (pts == AV_NOPTS_VALUE) {
+      return discard;
+    }
+    bool const unwanted =
+        pts < this->discard_before ||
+        (this->is_sampling() &&
+         !this->is_selected(this->timestamp_to_number(pts), pts));
+    return unwanted ? std::max(discard, AVDISCARD_NONREF) : discard;
+  }
+
+  // sets `av_frame` to the next frame to return, skipping the frames
+  // the sampling doesn't select. Returns false at the end
+  bool decode_selected(Frame::number_t* number) {
+    while (true) {
+      if (this->frame_pending) {
+        this->frame_pending = false;
+      } else if (!this->decode_next()) {
+        return false;
+      }
+      *number = this->current_frame;
+      if (!this->is_sampling() && !this->keyframes_only &&
+          !this->realtime_gap) {
+        return true;
+      }
+      // skipped frames never leave the decoder, so count by timestamps
+      int64_t const timestamp = this->av_frame->best_effort_timestamp;
+      if (timestamp != AV_NOPTS_VALUE) {
+        *number = this->timestamp_to_number(timestamp);
+      }
+      if (this->is_selected(*number, timestamp)) {
+        return true;
+      }
+      this->current_frame = *number + 1;
+    }
+  }
+
+  // `av_frame` with `number` from `decode_selected` is returned
+  void frame_returned(Frame::number_t number) {
+    this->current_frame = number + 1;
+    int64_t const timestamp = this->av_frame->best_effort_timestamp;
+    if (this->target_fps > 0.0 && timestamp != AV_NOPTS_VALUE) {
+      this->last_sample = this->sample_slot(timestamp);
+    }
+  }
+
+  VideoReader::FrameUP decode_frame(bool decode) {
+    Frame::number_t number{};
+    if (!this->decode_selected(&number)) {
+      return {nullptr};
+    }
+    this->frame_returned(number);
+    return this->convert_frame(
+        this->av_frame.get(), this->converter, number, decode);
+  }
+
+  VideoReader::Batch next_frames(std::size_t n, bool decode) {
+    VideoReader::Batch batch{};
+    batch.numbers.reserve(n);
+    batch.timestamps_s.reserve(n);
+    // these modes produce frames before they are requested, copy them
+    bool const ready_frames =
+        this->segment_decoder || this->decode_ahead || this->zero_copy;
+    while (batch.count < n) {
+      VideoReader::FrameUP frame;
+      VRImage image;
+      Frame::number_t number{};
+      if (ready_frames || this->batch_pending) {
+        frame = this->next_frame(decode);
+        if (!frame) {
+          break;
         }
-        int32_t alignment = 16;
-        int32_t const preferred_stride =
-            (this->codec_context->width * 3 + alignment - 1) & ~(alignment - 1);
-
-        Frame::timestamp_s_t timestamp_s = -1.0;
-        if (this->av_frame->pkt_dts != AV_NOPTS_VALUE) {
-          timestamp_s =
-              this->av_frame->best_effort_timestamp *
-              av_q2d(this->format_context->streams[local_packet->stream_index]
-                         ->time_base);
+        image = frame->image;
+      } else {
+        if (!this->decode_selected(&number)) {
+          break;
         }
-        Frame::number_t const number = this->current_frame++;
-
-        FrameUP ret(new Frame(
-            this->deallocate_callback,
+        image = this->output_image();
+      }
+      if (!batch.tensor) {
+        VRImage tensor_image = image;
+        tensor_image.height = image.height * static_cast<int32_t>(n);
+        tensor_image.data = nullptr;
+        tensor_image.user_data = nullptr;
+        // like `next_frame`, `decode == false` allocates no pixel memory
+        batch.tensor.reset(new Frame(
+            decode ? this->deallocate_callback : nullptr,
             this->log_info.userdata,
-            {
-                this->codec_context->height,  // height
-                this->codec_context->width,  // width
-                3,  // channels
-                SCALAR_TYPE::U8,  // scalar_type
-                preferred_stride,  // stride
-                nullptr,  // data
-                nullptr,  // user_data
-            },
-            number,
-            timestamp_s));
-        VRImage* image = &ret->image;
-
-        (*this->allocate_callback)(image, this->log_info.userdata);
-        if (!image->data) {
-          throw std::runtime_error(
-              "allocation callback failed: data is nullptr");
+            tensor_image,
+            frame ? frame->number : number,
+            frame ? frame->timestamp_s
+                  : this->timestamp_s(this->av_frame.get())));
+        if (decode) {
+          (*this->allocate_callback)(
+              &batch.tensor->image, this->log_info.userdata);
+          if (!batch.tensor->image.data) {
+            batch.tensor->free = nullptr;
+            throw std::runtime_error(
+                "allocation callback failed: data is nullptr");
+          }
         }
-        if (!this->sws_context) {  // because broken videos are weird
-          this->sws_context = _create_converter(
-              (AVPixelFormat)this->av_frame->format,
-              this->codec_context->width,
-              this->codec_context->height);
+        batch.frame_height = image.height;
+      }
+      VRImage slot = batch.tensor->image;
+      if (image.width != slot.width || image.height != batch.frame_height ||
+          image.channels != slot.channels ||
+          (frame && image.stride != slot.stride)) {
+        // the frame starts the next batch
+        if (frame) {
+          this->batch_pending = std::move(frame);
+        } else {
+          this->frame_pending = true;
         }
+        break;
+      }
+      slot.height = batch.frame_height;
+      if (decode) {
+        slot.data += static_cast<std::ptrdiff_t>(batch.count) *
+                     batch.frame_height * slot.stride;
+      }
+      if (frame) {
         if (decode) {
-          sws_scale(
-              this->sws_context.get(),
-              this->av_frame->data,
-              this->av_frame->linesize,
-              0,
-              this->av_frame->height,
-              &image->data,
-              &image->stride);
+          std::copy_n(
+              image.data,
+              static_cast<std::size_t>(image.stride) * image.height,
+              slot.data);
         }
-        if (!this->pushers.empty()) {
-          MallocStream stream{32};
-          thismsgpack::pack_array_header(this->pushers.size(), stream);
-          for (auto const& pusher : this->pushers) {
-            pusher(this->av_frame.get(), stream);
+        batch.numbers.push_back(frame->number);
+        batch.timestamps_s.push_back(frame->timestamp_s);
+        batch.extras.insert(
+            batch.extras.end(),
+            frame->extras,
+            frame->extras + frame->extras_size);
+      } else {
+        if (decode) {
+          this->convert_pixels(this->av_frame.get(), slot, this->converter);
+        }
+        this->frame_returned(number);
+        batch.numbers.push_back(number);
+        batch.timestamps_s.push_back(this->timestamp_s(this->av_frame.get()));
+        this->pack_extras(this->av_frame.get(), batch.extras);
+      }
+      ++batch.count;
+    }
+    return batch;
+  }
+
+  // `decode_thread` body, `decode` argument of `next_frame` is ignored,
+  // because the frames are converted before they are requested
+  void decode() noexcept {
+    try {
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(this->ready_mutex);
+          this->ready_cv.wait(lock, [&] {
+            return this->stop_requested || this->decode_pause_requested ||
+                   this->ready_frames.size() < this->decode_ahead;
+          });
+          if (this->stop_requested || this->decode_pause_requested) {
+            break;
           }
-          ret->extras = stream.data();
-          ret->extras_size = stream.size();
         }
-        return ret;
+        VideoReader::FrameUP frame = this->decode_frame(true);
+        if (!frame) {
+          break;
+        }
+        {
+          std::lock_guard<std::mutex> guard(this->ready_mutex);
+          this->ready_frames.push_back(std::move(frame));
+        }
+        this->ready_cv.notify_all();
       }
-      //}
-    }  // while (true)
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(this->ready_mutex);
+      this->decode_exception = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> guard(this->ready_mutex);
+      this->decode_ended = true;
+    }
+    this->ready_cv.notify_all();
+  }
+
+  VideoReader::FrameUP pop_ready_frame() {
+    std::unique_lock<std::mutex> lock(this->ready_mutex);
+    this->ready_cv.wait(lock, [&] {
+      return !this->ready_frames.empty() || this->decode_ended ||
+             this->stop_requested;
+    });
+    if (!this->ready_frames.empty()) {
+      VideoReader::FrameUP frame = std::move(this->ready_frames.front());
+      this->ready_frames.pop_front();
+      lock.unlock();
+      this->ready_cv.notify_all();
+      return frame;
+    }
+    if (this->decode_exception) {
+      std::rethrow_exception(this->decode_exception);
+    }
     return {nullptr};
   }
+
+  // joins `decode_thread` and drops frames it decoded
+  void stop_decode_thread() {
+    {
+      std::lock_guard<std::mutex> guard(this->ready_mutex);
+      this->decode_pause_requested = true;
+    }
+    this->ready_cv.notify_all();
+    this->decode_thread.join();
+    std::deque<VideoReader::FrameUP> dropped;
+    {
+      std::lock_guard<std::mutex> guard(this->ready_mutex);
+      std::swap(dropped, this->ready_frames);
+      this->decode_pause_requested = false;
+      this->decode_ended = false;
+      this->decode_exception = nullptr;
+    }
+  }
+
+  // decoded frame size after "crop"
+  int32_t source_width() const {
+    return this->crop[2] ? this->crop[2] : this->codec_context->width;
+  }
+
+  int32_t source_height() const {
+    return this->crop[3] ? this->crop[3] : this->codec_context->height;
+  }
+
+  // converted frame size, luma plane size for yuv
+  void output_size(int32_t* width, int32_t* height) const {
+    int32_t const source_width = this->source_width();
+    int32_t const source_height = this->source_height();
+    *width = this->output_width;
+    *height = this->output_height;
+    if (!*width && !*height) {
+      *width = source_width;
+      *height = source_height;
+    } else if (!*width && source_height > 0) {  // keep aspect ratio
+      *width = static_cast<int32_t>(
+          av_rescale(source_width, *height, source_height));
+    } else if (!*height && source_width > 0) {
+      *height = static_cast<int32_t>(
+          av_rescale(source_height, *width, source_width));
+    }
+    *width = std::max(*width, int32_t{1});
+    *height = std::max(*height, int32_t{1});
+  }
+
+  void apply_crop(AVFrame* av_frame) const {
+    if (!this->crop[2]) {
+      return;
+    }
+    int32_t const right = av_frame->width - this->crop[0] - this->crop[2];
+    int32_t const bottom = av_frame->height - this->crop[1] - this->crop[3];
+    if (right < 0 || bottom < 0) {
+      throw std::runtime_error("crop is outside of the frame");
+    }
+    av_frame->crop_left = this->crop[0];
+    av_frame->crop_top = this->crop[1];
+    av_frame->crop_right = right;
+    av_frame->crop_bottom = bottom;
+    int const ret = av_frame_apply_cropping(av_frame, AV_FRAME_CROP_UNALIGNED);
+    if (ret < 0) {
+      throw std::runtime_error(
+          "av_frame_apply_cropping failed " + get_av_error(ret));
+    }
+  }
+
+  // layout of converted frames, without data
+  VRImage output_image() const {
+    int32_t width{}, luma_height{};
+    this->output_size(&width, &luma_height);
+    PIXEL_FORMAT const format = this->output_format;
+    bool const is_yuv = _is_yuv(format);
+    if (is_yuv && (width % 2 != 0 || luma_height % 2 != 0)) {
+      throw std::runtime_error("yuv output requires even frame size");
+    }
+    int32_t const channels = _get_channels(format);
+    int32_t const preferred_stride =
+        aligned_stride(width * channels, this->row_alignment);
+    return {
+        is_yuv ? luma_height + luma_height / 2 : luma_height,  // height
+        width,  // width
+        channels,  // channels
+        SCALAR_TYPE::U8,  // scalar_type
+        preferred_stride,  // stride
+        nullptr,  // data
+        nullptr,  // user_data
+        format,  // pixel_format
+    };
+  }
+
+  Frame::timestamp_s_t timestamp_s(AVFrame const* av_frame) const {
+    if (av_frame->pkt_dts == AV_NOPTS_VALUE) {
+      return -1.0;
+    }
+    return av_frame->best_effort_timestamp *
+           av_q2d(this->av_stream->time_base);
+  }
+
+  VideoReader::FrameUP convert_frame(
+      AVFrame const* av_frame,
+      FrameConverter& converter,
+      Frame::number_t number,
+      bool decode) const {
+    VRImage const output_image = this->output_image();
+    PIXEL_FORMAT const format = output_image.pixel_format;
+    Frame::timestamp_s_t const timestamp_s = this->timestamp_s(av_frame);
+
+    if (!decode) {  // no pixel memory, `output_image().data` is nullptr
+      FrameUP ret(new Frame(
+          nullptr, this->log_info.userdata, output_image, number, timestamp_s));
+      this->pack_extras(av_frame, *ret);
+      return ret;
+    }
+
+    if (this->zero_copy && av_frame->width == output_image.width &&
+        av_frame->height == _luma_height(output_image) &&
+        _can_share_frame(av_frame, format)) {
+      AVFrame* const reference = av_frame_clone(av_frame);
+      if (!reference) {
+        throw std::runtime_error("av_frame_clone failed");
+      }
+      VRImage shared_image = output_image;
+      shared_image.stride = reference->linesize[0];
+      shared_image.data = reference->data[0];
+      FrameUP ret(new Frame(
+          _free_shared_frame, reference, shared_image, number, timestamp_s));
+      this->pack_extras(av_frame, *ret);
+      return ret;
+    }
+
+    FrameUP ret(new Frame(
+        this->deallocate_callback,
+        this->log_info.userdata,
+        output_image,
+        number,
+        timestamp_s));
+    VRImage* image = &ret->image;
+
+    (*this->allocate_callback)(image, this->log_info.userdata);
+    if (!image->data) {
+      throw std::runtime_error("allocation callback failed: data is nullptr");
+    }
+    if (_is_yuv(format) && image->stride % 2 != 0) {
+      throw std::runtime_error("yuv output requires even stride");
+    }
+    this->convert_pixels(av_frame, *image, converter);
+    this->pack_extras(av_frame, *ret);
+    return ret;
+  }
+
+  void convert_pixels(
+      AVFrame const* av_frame,
+      VRImage const& image,
+      FrameConverter& converter) const {
+    int const height = _luma_height(image);
+    bool const is_scaled =
+        av_frame->width != image.width || av_frame->height != height;
+    // bands start at multiples of 16 rows, so that subsampled
+    // chroma planes split at the same rows. Scaling filters need
+    // neighbour rows, so scaled frames are converted at once
+    int const MIN_BAND_ROWS = 64;
+    std::size_t const bands = converter.pool && !is_scaled
+                                  ? std::min<std::size_t>(
+                                        converter.pool->size(),
+                                        height / MIN_BAND_ROWS)
+                                  : 1;
+    if (bands <= 1) {
+      this->convert_rows(av_frame, image, converter.sws_context, 0, height);
+      return;
+    }
+    int const band_rows =
+        ((height + static_cast<int>(bands) - 1) / static_cast<int>(bands) +
+         15) &
+        ~15;
+    converter.band_contexts.resize(bands);
+    converter.pool->parallel_for(bands, [&](std::size_t band) {
+      int const row_begin = static_cast<int>(band) * band_rows;
+      int const row_end = std::min(row_begin + band_rows, height);
+      if (row_begin < row_end) {
+        this->convert_rows(
+            av_frame,
+            image,
+            converter.band_contexts[band],
+            row_begin,
+            row_end);
+      }
+    });
+  }
+
+  // converts rows [row_begin, row_end) of `av_frame` to `image`.
+  // `row_begin` is a multiple of 16
+  void convert_rows(
+      AVFrame const* av_frame,
+      VRImage const& image,
+      SwsContextUP& sws_context,
+      int row_begin,
+      int row_end) const {
+    int32_t const width = image.width;
+    int32_t const luma_height = _luma_height(image);
+    bool const is_whole = row_begin == 0 && row_end == luma_height;
+    bool const is_scaled =
+        av_frame->width != width || av_frame->height != luma_height;
+    int const rows = row_end - row_begin;
+    PIXEL_FORMAT const format = image.pixel_format;
+    int32_t const channels = _get_channels(format);
+    uint8_t* dst_data[4]{};
+    int dst_linesize[4]{};
+    _fill_planes(image, luma_height, dst_data, dst_linesize);
+    for (int plane = 0; plane < 4 && dst_data[plane]; ++plane) {
+      int const plane_row = plane == 0 ? row_begin : row_begin / 2;
+      dst_data[plane] += static_cast<std::ptrdiff_t>(plane_row) *
+                         dst_linesize[plane];
+    }
+    AVPixelFormat const src_format =
+        _strip_jpeg_range(static_cast<AVPixelFormat>(av_frame->format));
+    AVPixelFormat const dst_format = _to_av_pixel_format(format);
+    if (!is_scaled &&
+        (src_format == dst_format ||
+         (format == PIXEL_FORMAT::GRAY8 && _has_luma_plane(src_format)))) {
+      // the decoder already has what is requested, copy planes as is
+      int const planes = av_pix_fmt_count_planes(dst_format);
+      for (int plane = 0; plane < planes; ++plane) {
+        int const bytewidth = plane == 0 ? width * channels
+                              : format == PIXEL_FORMAT::NV12 ? width
+                                                             : width / 2;
+        int const plane_row = plane == 0 ? row_begin : row_begin / 2;
+        av_image_copy_plane(
+            dst_data[plane],
+            dst_linesize[plane],
+            av_frame->data[plane] +
+                static_cast<std::ptrdiff_t>(plane_row) *
+                    av_frame->linesize[plane],
+            av_frame->linesize[plane],
+            bytewidth,
+            plane == 0 ? rows : (row_end + 1) / 2 - plane_row);
+      }
+    } else if (
+        !is_scaled && format == PIXEL_FORMAT::RGB24 &&
+        (src_format == AV_PIX_FMT_YUV420P || src_format == AV_PIX_FMT_NV12)) {
+      bool const is_nv12 = src_format == AV_PIX_FMT_NV12;
+      std::ptrdiff_t const y_offset =
+          static_cast<std::ptrdiff_t>(row_begin) * av_frame->linesize[0];
+      std::ptrdiff_t const uv_offset =
+          static_cast<std::ptrdiff_t>(row_begin / 2) * av_frame->linesize[1];
+      yuv420_to_rgb24(
+          YUV420Planes{
+              av_frame->data[0] + y_offset,
+              av_frame->data[1] + uv_offset,
+              (is_nv12 ? av_frame->data[1] + 1 : av_frame->data[2]) +
+                  uv_offset,
+              av_frame->linesize[0],
+              av_frame->linesize[1],
+              is_nv12 ? 2 : 1},
+          dst_data[0],
+          dst_linesize[0],
+          width,
+          rows);
+    } else {
+      if (!sws_context) {  // because broken videos are weird
+        sws_context = _create_converter(
+            (AVPixelFormat)av_frame->format,
+            av_frame->width,
+            is_whole ? av_frame->height : rows,
+            width,
+            rows,
+            dst_format,
+            this->sws_flags);
+      }
+      // a band is converted as a separate image of `rows` height
+      uint8_t const* src_data[4]{};
+      AVPixFmtDescriptor const* desc =
+          av_pix_fmt_desc_get(static_cast<AVPixelFormat>(av_frame->format));
+      for (int plane = 0; plane < 4; ++plane) {
+        if (!av_frame->data[plane]) {
+          continue;
+        }
+        bool const is_chroma = desc && (plane == 1 || plane == 2);
+        int const plane_row =
+            is_chroma ? row_begin >> desc->log2_chroma_h : row_begin;
+        src_data[plane] = av_frame->data[plane] +
+                          static_cast<std::ptrdiff_t>(plane_row) *
+                              av_frame->linesize[plane];
+      }
+      sws_scale(
+          sws_context.get(),
+          src_data,
+          av_frame->linesize,
+          0,
+          is_whole ? av_frame->height : rows,
+          dst_data,
+          dst_linesize);
+    }
+  }
+
+  void pack_extras(AVFrame const* av_frame, Frame& frame) const {
+    if (!this->pushers.empty()) {
+      MallocStream stream{32};
+      thismsgpack::pack_array_header(this->pushers.size(), stream);
+      for (auto const& pusher : this->pushers) {
+        pusher(av_frame, stream);
+      }
+      frame.extras = stream.data();
+      frame.extras_size = stream.size();
+    }
+  }
+
+  void pack_extras(
+      AVFrame const* av_frame, std::vector<unsigned char>& out) const {
+    if (!this->pushers.empty()) {
+      MallocStream stream{32};
+      thismsgpack::pack_array_header(this->pushers.size(), stream);
+      for (auto const& pusher : this->pushers) {
+        pusher(av_frame, stream);
+      }
+      out.insert(out.end(), stream.data(), stream.data() + stream.size());
+      ::free(stream.data());
+    }
+  }
+
+  AVRational frame_rate() const {
+    AVRational rate = this->av_stream->avg_frame_rate;
+    if (rate.num <= 0 || rate.den <= 0) {
+      rate = this->av_stream->r_frame_rate;
+    }
+    if (rate.num <= 0 || rate.den <= 0) {
+      throw std::runtime_error("unknown frame rate");
+    }
+    return rate;
+  }
+
+  int64_t start_timestamp() const {
+    return this->av_stream->start_time != AV_NOPTS_VALUE
+               ? this->av_stream->start_time
+               : 0;
+  }
+
+  // frame number <-> `av_stream->time_base` timestamp conversion.
+  // Exact with `index`, otherwise for constant frame rate videos only
+  int64_t number_to_timestamp(Frame::number_t number) const {
+    if (this->index) {
+      return this->index->frame_timestamp(number);
+    }
+    return this->start_timestamp() +
+           av_rescale_q(
+               static_cast<int64_t>(number),
+               av_inv_q(this->frame_rate()),
+               this->av_stream->time_base);
+  }
+
+  Frame::number_t timestamp_to_number(int64_t timestamp) const {
+    if (this->index) {
+      return this->index->frame_number(timestamp);
+    }
+    int64_t const number = av_rescale_q(
+        timestamp - this->start_timestamp(),
+        this->av_stream->time_base,
+        av_inv_q(this->frame_rate()));
+    return static_cast<Frame::number_t>(std::max(number, int64_t{0}));
+  }
+
+  // `timestamp` is in `av_stream->time_base` units.
+  // Returns the number of the next frame
+  Frame::number_t seek(int64_t timestamp) {
+    if (!this->is_seekable()) {
+      throw std::runtime_error("video is not seekable");
+    }
+    if (this->segment_decoder) {
+      Frame::number_t const number = this->timestamp_to_number(timestamp);
+      this->segment_decoder->seek(number);
+      return number;
+    }
+    if (this->decode_thread.joinable()) {  // restarted by `next_frame`
+      this->stop_decode_thread();
+    }
+    this->seek_timestamp =
+        this->index ? this->index->keyframe_timestamp(timestamp) : timestamp;
+    if (this->inline_read) {
+      this->seek_demuxer();
+    } else {
+      this->seek_requested = true;
+      this->read_parker.wake();
+      if (!this->drop_packets_until_seek_done()) {
+        return 0;  // stopped
+      }
+    }
+    this->stream_ended = false;
+    this->draining = false;
+    this->realtime_gap = false;
+    if (this->seek_ret < 0) {
+      throw std::runtime_error(
+          "av_seek_frame failed " + get_av_error(this->seek_ret));
+    }
+    avcodec_flush_buffers(this->codec_context.get());
+    this->frame_pending = false;
+    this->last_sample = INT64_MIN;
+    // decode without conversion up to the requested frame, non-reference
+    // frames before it aren't decoded at all
+    this->discard_before = timestamp;
+    while (this->decode_next()) {
+      int64_t const frame_timestamp = this->av_frame->best_effort_timestamp;
+      if (frame_timestamp != AV_NOPTS_VALUE && frame_timestamp >= timestamp) {
+        this->current_frame = this->timestamp_to_number(frame_timestamp);
+        this->frame_pending = true;
+        this->discard_before = INT64_MIN;
+        return this->current_frame;
+      }
+    }
+    this->discard_before = INT64_MIN;
+    if (!this->stop_requested) {
+      throw std::runtime_error("seek past the end of the video");
+    }
+    return 0;
+  }
 };
 
+SegmentDecoder::SegmentDecoder(
+    VideoReaderFFmpeg::Impl const* impl,
+    std::string const& url,
+    std::size_t workers) :
+    impl{impl},
+    url{url},
+    window{workers * 2} {
+  // GOPs shorter than this are merged, so the workers don't spend
+  // most of the time seeking
+  VideoReader::Frame::number_t const MIN_SEGMENT_FRAMES = 16;
+
+  PacketIndex const& index = *impl->index;
+  // smallest pts from a decode position on. Frames of a segment can be
+  // reordered after the next keyframe (B-frames of an open GOP, pyramids
+  // of any depth), its last packet is the last one shown before that
+  // keyframe, which is found with a binary search
+  std::vector<int64_t> min_pts_after(index.size());
+  for (uint64_t pos = index.size(); pos-- > 0;) {
+    min_pts_after[pos] = pos + 1 < index.size()
+                             ? std::min(index[pos].pts, min_pts_after[pos + 1])
+                             : index[pos].pts;
+  }
+  std::vector<uint64_t> keyframes;  // decode order positions
+  for (uint64_t pos = 0; pos < index.size(); ++pos) {
+    if (index[pos].flags & AV_PKT_FLAG_KEY) {
+      keyframes.push_back(pos);
+    }
+  }
+  if (keyframes.empty() || keyframes.front() != 0) {
+    keyframes.insert(keyframes.begin(), 0);
+  }
+  for (std::size_t key_idx = 0; key_idx < keyframes.size();) {
+    uint64_t const begin = keyframes[key_idx];
+    VideoReader::Frame::number_t const first_frame =
+        this->segments.empty() ? 0 : index.frame_number(index[begin].pts);
+    std::size_t next_idx = key_idx + 1;
+    while (next_idx < keyframes.size() &&
+           index.frame_number(index[keyframes[next_idx]].pts) - first_frame <
+               MIN_SEGMENT_FRAMES) {
+      ++next_idx;
+    }
+    bool const is_last = next_idx >= keyframes.size();
+    uint64_t const end = is_last ? index.size() : keyframes[next_idx];
+    Segment segment{};
+    segment.first_frame = first_frame;
+    segment.end_frame =
+        is_last ? index.size() : index.frame_number(index[end].pts);
+    segment.keyframe_timestamp = index[begin].pts;
+    uint64_t last_packet = end;
+    if (!is_last) {
+      int64_t const end_pts = index[end].pts;
+      auto const it = std::partition_point(
+          min_pts_after.begin() + end,
+          min_pts_after.end(),
+          [end_pts](int64_t pts) { return pts < end_pts; });
+      last_packet = std::max(
+          end, static_cast<uint64_t>(it - min_pts_after.begin()) - 1);
+    }
+    segment.read_to_end = last_packet + 1 >= index.size();
+    segment.last_packet_timestamp =
+        segment.read_to_end ? 0 : index[last_packet].pts;
+    if (segment.end_frame > segment.first_frame) {
+      this->segments.push_back(segment);
+    }
+    key_idx = next_idx;
+  }
+  impl->log(
+      "segment_workers: " + std::to_string(this->segments.size()) +
+          " segments of " + std::to_string(index.size()) + " frames",
+      VideoReader::LogLevel::DEBUG);
+  for (std::size_t worker_idx = 0; worker_idx < workers; ++worker_idx) {
+    this->threads.emplace_back(&SegmentDecoder::work, this);
+  }
+}
+
+SegmentDecoder::~SegmentDecoder() {
+  {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->stop_requested = true;
+    this->outputs.clear();
+  }
+  this->cv.notify_all();
+  for (auto& thread : this->threads) {
+    thread.join();
+  }
+}
+
+void SegmentDecoder::work() noexcept {
+  try {
+    // `print_prefix` is per context chain, so every worker has a copy
+    FFmpegLogInfo log_info{
+        this->impl->log_info.log_callback, this->impl->log_info.userdata, 1};
+    // the same format and protocol options give the same stream layout
+    AVDictionaryUP options = _copy_dict(this->impl->ffmpeg_options);
+    std::unique_ptr<CustomIO> io =
+        this->impl->io ? this->impl->io->clone() : nullptr;
+    AVFormatContextUP format_context = _get_format_context(
+        this->url,
+        options,
+        &log_info,
+        io ? io->context() : nullptr,
+        &this->impl->stop_requested);
+    int const stream_index = this->impl->av_stream->index;
+    if (static_cast<unsigned>(stream_index) >= format_context->nb_streams) {
+      throw std::runtime_error("segment decoder: video stream not found");
+    }
+    _discard_other_streams(format_context.get(), stream_index);
+    // options the demuxer didn't take are codec options. Segments are the
+    // parallelism, don't oversubscribe with codec threads
+    AVDictionary* codec_options_raw = options.release();
+    av_dict_set(&codec_options_raw, "threads", "1", 0);
+    AVDictionaryUP codec_options{codec_options_raw};
+    AVCodecContextUP codec_context = _get_codec_context(
+        this->impl->av_stream->codecpar, codec_options, &log_info);
+    FrameConverter converter;
+
+    while (true) {
+      std::size_t segment_idx{};
+      uint64_t generation{};
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cv.wait(lock, [&] {
+          return this->stop_requested ||
+                 (this->next < this->segments.size() &&
+                  this->next < this->current + this->window);
+        });
+        if (this->stop_requested) {
+          return;
+        }
+        segment_idx = this->next++;
+        generation = this->generation;
+      }
+      this->decode_segment(
+          segment_idx,
+          generation,
+          format_context.get(),
+          codec_context.get(),
+          converter);
+    }
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> guard(this->mutex);
+      if (!this->exception) {
+        this->exception = std::current_exception();
+      }
+    }
+    this->cv.notify_all();
+  }
+}
+
+void SegmentDecoder::decode_segment(
+    std::size_t segment_idx,
+    uint64_t generation,
+    AVFormatContext* format_context,
+    AVCodecContext* codec_context,
+    FrameConverter& converter) {
+  Segment const& segment = this->segments[segment_idx];
+  int const stream_index = this->impl->av_stream->index;
+  avcodec_flush_buffers(codec_context);
+  int const seek_ret = av_seek_frame(
+      format_context,
+      stream_index,
+      segment.keyframe_timestamp,
+      AVSEEK_FLAG_BACKWARD);
+  if (seek_ret < 0) {
+    throw std::runtime_error(
+        "segment decoder: av_seek_frame failed " + get_av_error(seek_ret));
+  }
+  AVPacketUP packet(av_packet_alloc());
+  AVFrameUP av_frame(av_frame_alloc());
+  VideoReader::Frame::number_t const expected =
+      segment.end_frame - segment.first_frame;
+  VideoReader::Frame::number_t produced = 0;
+  bool flushing = false;
+  while (produced < expected) {
+    {
+      std::lock_guard<std::mutex> guard(this->mutex);
+      if (this->stop_requested || this->generation != generation) {
+        return;  // abandoned by seek
+      }
+    }
+    if (!flushing) {
+      int const read_ret = av_read_frame(format_context, packet.get());
+      if (read_ret < 0) {
+        avcodec_send_packet(codec_context, nullptr);
+        flushing = true;
+      } else if (packet->stream_index == stream_index) {
+        int64_t const packet_timestamp =
+            packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        avcodec_send_packet(codec_context, packet.get());
+        av_packet_unref(packet.get());
+        if (!segment.read_to_end &&
+            packet_timestamp == segment.last_packet_timestamp) {
+          avcodec_send_packet(codec_context, nullptr);
+          flushing = true;
+        }
+      } else {
+        av_packet_unref(packet.get());
+        continue;
+      }
+    }
+    int receive_ret;
+    while ((receive_ret = avcodec_receive_frame(
+                codec_context, av_frame.get())) == 0) {
+      int64_t const frame_timestamp = av_frame->best_effort_timestamp;
+      if (frame_timestamp == AV_NOPTS_VALUE) {
+        continue;
+      }
+      VideoReader::Frame::number_t const number =
+          this->impl->index->frame_number(frame_timestamp);
+      if (number < segment.first_frame || number >= segment.end_frame) {
+        continue;  // belongs to a neighbour segment
+      }
+      this->impl->apply_crop(av_frame.get());
+      VideoReader::FrameUP frame =
+          this->impl->convert_frame(av_frame.get(), converter, number, true);
+      ++produced;
+      {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        if (this->stop_requested || this->generation != generation) {
+          return;
+        }
+        this->outputs[segment_idx].frames.push_back(std::move(frame));
+      }
+      this->cv.notify_all();
+    }
+    if (receive_ret == AVERROR_EOF) {
+      break;  // the rest of the segment is undecodable
+    }
+    if (flushing && receive_ret == AVERROR(EAGAIN)) {
+      break;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if (this->generation == generation) {
+      this->outputs[segment_idx].done = true;
+    }
+  }
+  this->cv.notify_all();
+}
+
+VideoReader::FrameUP SegmentDecoder::next_frame() {
+  VideoReader::FrameUP frame;
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    if (this->exception) {
+      std::rethrow_exception(this->exception);
+    }
+    if (this->current >= this->segments.size()) {
+      return {nullptr};
+    }
+    Output& output = this->outputs[this->current];
+    if (!output.frames.empty()) {
+      frame = std::move(output.frames.front());
+      output.frames.pop_front();
+      if (frame->number < this->skip_until) {
+        lock.unlock();
+        frame.reset();  // deallocate without holding the lock
+        lock.lock();
+        continue;
+      }
+      return frame;
+    }
+    if (output.done) {
+      this->outputs.erase(this->current);
+      ++this->current;
+      this->cv.notify_all();
+      continue;
+    }
+    this->cv.wait(lock);
+  }
+}
+
+void SegmentDecoder::seek(VideoReader::Frame::number_t number) {
+  std::unordered_map<std::size_t, Output> abandoned;
+  {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    ++this->generation;
+    std::swap(abandoned, this->outputs);
+    auto const it = std::upper_bound(
+        this->segments.begin(),
+        this->segments.end(),
+        number,
+        [](VideoReader::Frame::number_t number, Segment const& segment) {
+          return number < segment.first_frame;
+        });
+    this->current = it == this->segments.begin()
+                        ? 0
+                        : static_cast<std::size_t>(
+                              it - this->segments.begin() - 1);
+    this->next = this->current;
+    this->skip_until = number;
+  }
+  this->cv.notify_all();
+}
+
 VideoReaderFFmpeg::VideoReaderFFmpeg(
     std::string const& url,
     std::vector<std::string> const& parameter_pairs,
@@ -482,7 +2431,8 @@ VideoReaderFFmpeg::VideoReaderFFmpeg(
     AllocateCallback allocate_callback,
     DeallocateCallback deallocate_callback,
     LogCallback log_callback,
-    void* userdata) {
+    void* userdata,
+    std::unique_ptr<CustomIO> io) {
   avformat_network_init();
   avdevice_register_all();
   av_log_set_level(AV_LOG_INFO);
@@ -499,7 +2449,8 @@ VideoReaderFFmpeg::VideoReaderFFmpeg(
       allocate_callback,
       deallocate_callback,
       log_callback,
-      userdata);
+      userdata,
+      std::move(io));
 }
 
 bool VideoReaderFFmpeg::is_seekable() const {
@@ -507,30 +2458,117 @@ bool VideoReaderFFmpeg::is_seekable() const {
 }
 
 VideoReader::Frame::number_t VideoReaderFFmpeg::size() const {
+  if (this->impl->index) {
+    return this->impl->index->size();
+  }
   return static_cast<VideoReader::Frame::number_t>(
       this->impl->av_stream->nb_frames);
 }
 
+void VideoReaderFFmpeg::seek(Frame::number_t number) {
+  this->impl->seek(this->impl->number_to_timestamp(number));
+}
+
+void VideoReaderFFmpeg::reopen(std::string const& url) {
+  this->impl->reopen(url);
+}
+
+VideoReader::Frame::number_t VideoReaderFFmpeg::seek_time(
+    Frame::timestamp_s_t timestamp_s) {
+  return this->impl->seek(std::llround(
+      timestamp_s / av_q2d(this->impl->av_stream->time_base)));
+}
+
+bool VideoReaderFFmpeg::Impl::try_push_packet(AVPacket* packet) {
+  std::size_t const size = _is_marker(packet) ? 0 : packet->size;
+  this->queued_bytes += size;
+  QueuedPacket const queued{packet, this->skipped_packets};
+  if (!this->read_queue->try_push(queued)) {
+    this->queued_bytes -= size;
+    return false;
+  }
+  if (size && (packet->flags & AV_PKT_FLAG_KEY)) {
+    this->newest_keyframe = this->pushed_packets + 1;
+  }
+  ++this->pushed_packets;
+  this->skipped_packets = 0;
+  this->packet_parker.wake();
+  return true;
+}
+
+// for `SEEK_DONE` and `nullptr`, waits while `read_queue` is full
+bool VideoReaderFFmpeg::Impl::push_packet(AVPacket* packet) {
+  while (!this->try_push_packet(packet)) {
+    if (this->stop_requested) {
+      return false;
+    }
+    this->read_parker.park([&] {
+      return this->stop_requested || this->read_queue_drained();
+    });
+  }
+  return true;
+}
+
 AVPacket* VideoReaderFFmpeg::Impl::pop_packet() {
-  this->cv.wait(this->read_queue_lock, [&] {
-    return !this->read_queue.empty() || this->stop_requested;
-  });
-  if (!this->stop_requested) {
-    AVPacket* ret = this->read_queue.front();
-    this->read_queue.pop_front();
-    this->read_queue_lock.unlock();
-    return ret;
+  if (this->inline_read) {
+    return this->read_packet();
+  }
+  QueuedPacket queued{};
+  while (!this->stop_requested) {
+    // realtime overflow: skip to the newest queued keyframe
+    uint64_t const skip_until =
+        this->drop_requested.exchange(false) ? this->newest_keyframe - 1 : 0;
+    while (this->read_queue->try_pop(queued)) {
+      uint64_t const position = this->popped_packets++;
+      AVPacket* packet = queued.packet;
+      this->current_frame += queued.skipped;
+      this->realtime_gap |= queued.skipped != 0;
+      if (!_is_marker(packet)) {
+        this->queued_bytes -= packet->size;
+        if (position < skip_until) {
+          ++this->current_frame;  // guesstimate one packet is one frame
+          this->realtime_gap = true;
+          av_packet_free(&packet);
+          continue;
+        }
+      }
+      if (this->read_queue_drained()) {
+        this->read_parker.wake();
+      }
+      return packet;
+    }
+    this->packet_parker.park([&] {
+      return !this->read_queue->empty() || this->stop_requested;
+    });
   }
   return nullptr;
 }
 
+VideoReaderFFmpeg::Impl::~Impl() {
+  // threads are joined, so this is the only queue user
+  QueuedPacket queued{};
+  while (this->read_queue->try_pop(queued)) {
+    if (queued.packet != SEEK_DONE) {
+      av_packet_free(&queued.packet);
+    }
+  }
+}
+
 void VideoReaderFFmpeg::stop() {
   this->impl->stop_requested = true;
-  this->impl->cv.notify_one();
+  this->impl->read_parker.wake();
+  this->impl->packet_parker.wake();
+  {  // so a waiting thread can't miss `stop_requested`
+    std::lock_guard<std::mutex> guard(this->impl->ready_mutex);
+  }
+  this->impl->ready_cv.notify_all();
 }
 
 VideoReaderFFmpeg::~VideoReaderFFmpeg() {
   this->stop();
+  if (this->impl->decode_thread.joinable()) {
+    this->impl->decode_thread.join();
+  }
   if (this->impl->read_thread.joinable()) {
     this->impl->read_thread.join();
   }
@@ -539,3 +2577,11 @@ VideoReaderFFmpeg::~VideoReaderFFmpeg() {
 VideoReader::FrameUP VideoReaderFFmpeg::next_frame(bool decode) {
   return this->impl->next_frame(decode);
 }
+
+VideoReader::Batch VideoReaderFFmpeg::next_frames(std::size_t n, bool decode) {
+  return this->impl->next_frames(n, decode);
+}
+
+bool VideoReaderFFmpeg::would_block() const {
+  return this->impl->blocked;
+}
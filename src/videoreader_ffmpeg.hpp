@@ -1,3 +1,4 @@
+#include "ffmpeg_io.hpp"
 #include <videoreader/videoreader.hpp>
 
 class VideoReaderFFmpeg : public VideoReader {
@@ -9,11 +10,17 @@ public:
       AllocateCallback allocate_cb,
       DeallocateCallback deallocate_cb,
       LogCallback log_callback,
-      void* userdata);
+      void* userdata,
+      std::unique_ptr<CustomIO> io = nullptr);  // reads bytes in place of `url`
 
   bool is_seekable() const override;
   FrameUP next_frame(bool decode) override;
+  Batch next_frames(std::size_t n, bool decode) override;
+  bool would_block() const override;
   Frame::number_t size() const override;
+  void seek(Frame::number_t number) override;
+  Frame::number_t seek_time(Frame::timestamp_s_t timestamp_s) override;
+  void reopen(std::string const& url) override;
   void stop() override;
 
   struct Impl;
@@ -1,4 +1,5 @@
 #include "videoreader_galaxy.hpp"
+#include "row_alignment.hpp"
 #include "spinlock.hpp"
 #include "thismsgpack.hpp"
 #include <GxIAPI.h>
@@ -380,6 +381,7 @@ struct VideoReaderGalaxy::Impl {
   std::exception_ptr exception;
   std::vector<DoublePusher> pushers;
   double timestamp_tick_frequency;
+  std::atomic<int32_t> row_alignment{DEFAULT_ROW_ALIGNMENT};  // "alignment"
   AllocateCallback allocate_callback;
   DeallocateCallback deallocate_callback;
   VideoReader::LogCallback log_callback;
@@ -427,6 +429,10 @@ struct VideoReaderGalaxy::Impl {
          ++it) {
       std::string const key = to_lower(*it);
       std::string const& value = *++it;
+      if (key == "alignment") {
+        this->row_alignment = check_row_alignment(std::stoll(value));
+        continue;
+      }
       set_pair(this->handle, key, value);
     }
   }
@@ -544,9 +550,8 @@ struct VideoReaderGalaxy::Impl {
           continue;
         }
 
-        int32_t const alignment = 16;
         int32_t const preferred_stride =
-            (pFrameBuffer->nWidth * 1 + alignment - 1) & ~(alignment - 1);
+            aligned_stride(pFrameBuffer->nWidth * 1, this->row_alignment);
 
         Frame::timestamp_s_t const timestamp_s =
             (static_cast<double>(pFrameBuffer->nTimestamp) /
@@ -571,6 +576,7 @@ struct VideoReaderGalaxy::Impl {
                 preferred_stride,  // stride
                 nullptr,  // data
                 nullptr,  // user_data
+                PIXEL_FORMAT::GRAY8,  // pixel_format
             },
             number,
             timestamp_s));
@@ -591,10 +597,18 @@ struct VideoReaderGalaxy::Impl {
               "allocation callback failed: data is nullptr");
         }
 
-        std::memcpy(
-            image->data,
-            (uint8_t*)(pFrameBuffer->pImgBuf),
-            pFrameBuffer->nWidth * pFrameBuffer->nHeight);
+        uint8_t const* const src = (uint8_t*)(pFrameBuffer->pImgBuf);
+        if (image->stride == pFrameBuffer->nWidth) {
+          std::memcpy(
+              image->data, src, pFrameBuffer->nWidth * pFrameBuffer->nHeight);
+        } else {  // rows padded for "alignment"
+          for (int32_t row = 0; row < pFrameBuffer->nHeight; ++row) {
+            std::memcpy(
+                image->data + row * image->stride,
+                src + row * pFrameBuffer->nWidth,
+                pFrameBuffer->nWidth);
+          }
+        }
         GX_STATUS const gxqbuf_status = GXQBuf(this->handle, pFrameBuffer);
         {
           std::lock_guard<SpinLock> guard(this->read_queue_lock);
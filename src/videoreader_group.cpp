@@ -0,0 +1,313 @@
+#include "work_stealing_pool.hpp"
+#include <algorithm>  // std::find
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>  // std::to_string
+#include <thread>
+#include <videoreader/videoreader_group.hpp>
+
+// adds `key` unless `parameter_pairs` have it
+static void _set_default(
+    std::vector<std::string>& parameter_pairs,
+    char const* key,
+    char const* value) {
+  for (std::size_t idx = 0; idx + 1 < parameter_pairs.size(); idx += 2) {
+    if (parameter_pairs[idx] == key) {
+      return;
+    }
+  }
+  parameter_pairs.emplace_back(key);
+  parameter_pairs.emplace_back(value);
+}
+
+// whether `VideoReader::create` opens `url` with ffmpeg, not a camera SDK
+static bool _is_ffmpeg_url(std::string const& url) {
+  for (char const* prefix : {"pylon://", "galaxy://", "idatum://"}) {
+    if (url.rfind(prefix, 0) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// how long a source whose input had no data waits before the next try
+static constexpr std::chrono::milliseconds POLL_INTERVAL{2};
+
+struct VideoReaderGroup::Impl {
+  struct SourceState {
+    Source source;
+    std::unique_ptr<VideoReader> reader;  // created by the first task
+    bool realtime = false;
+    // guarded by `Impl::mutex`
+    std::deque<VideoReader::FrameUP> frames;
+    bool running = false;  // a task of the source is queued or running
+    bool ended = false;
+    std::exception_ptr error;
+    uint64_t dropped = 0;
+  };
+
+  std::vector<SourceState> sources;
+  std::size_t const queue_frames;
+  VideoReader::AllocateCallback const alloc_callback;
+  VideoReader::DeallocateCallback const dealloc_callback;
+  VideoReader::LogCallback const log_callback;
+  void* const userdata;
+
+  std::mutex mutex;  // guards everything below and `SourceState` queues
+  std::condition_variable cv;  // a frame was queued, a source ended or stop
+  std::deque<std::size_t> ready;  // source of every queued frame, in order
+  std::size_t active;  // sources that haven't ended
+  bool stop_requested = false;
+  // sources whose input had no data, resubmitted by `poll_thread`
+  // once their time comes. Sorted, every wait is `POLL_INTERVAL`
+  std::deque<std::pair<std::chrono::steady_clock::time_point, std::size_t>>
+      polls;
+  std::condition_variable poll_cv;  // a source was added to `polls` or stop
+
+  std::unique_ptr<WorkStealingPool> pool;  // joined after `poll_thread`
+  std::thread poll_thread;
+
+  Impl(
+      std::vector<Source> const& sources,
+      std::size_t threads,
+      std::size_t queue_frames,
+      VideoReader::AllocateCallback alloc_callback,
+      VideoReader::DeallocateCallback dealloc_callback,
+      VideoReader::LogCallback log_callback,
+      void* userdata) :
+      sources(sources.size()),
+      queue_frames{std::max(queue_frames, std::size_t{1})},
+      alloc_callback{alloc_callback},
+      dealloc_callback{dealloc_callback},
+      log_callback{log_callback},
+      userdata{userdata},
+      active{sources.size()} {
+    for (std::size_t idx = 0; idx < sources.size(); ++idx) {
+      Source source = sources[idx];
+      if (_is_ffmpeg_url(source.url)) {
+        // the pool is the only parallelism, and tasks must not wait
+        // for live input
+        _set_default(source.parameter_pairs, "read_thread", "0");
+        _set_default(source.parameter_pairs, "nonblocking", "1");
+        _set_default(source.parameter_pairs, "threads", "1");
+      }
+      this->sources[idx].source = std::move(source);
+      this->sources[idx].running = true;
+    }
+    if (threads == 0) {
+      threads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    this->pool = std::make_unique<WorkStealingPool>(threads);
+    this->poll_thread = std::thread(&Impl::poll, this);
+    for (std::size_t idx = 0; idx < this->sources.size(); ++idx) {
+      this->pool->submit([this, idx] { this->step(idx); });
+    }
+  }
+
+  ~Impl() {
+    this->stop();  // interrupts the readers, so running steps return
+    this->poll_thread.join();
+  }
+
+  // `poll_thread` body
+  void poll() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->stop_requested) {
+      if (this->polls.empty()) {
+        this->poll_cv.wait(lock);
+        continue;
+      }
+      auto const [when, idx] = this->polls.front();
+      if (this->poll_cv.wait_until(
+              lock, when, [this] { return this->stop_requested; })) {
+        return;
+      }
+      this->polls.pop_front();
+      this->pool->submit([this, idx] { this->step(idx); });
+    }
+  }
+
+  // pool task: opens the source or reads one frame of it. When the
+  // input has no data yet, the source is retried after `POLL_INTERVAL`
+  void step(std::size_t idx) {
+    SourceState& state = this->sources[idx];
+    VideoReader::FrameUP dropped;  // freed outside of the lock
+    try {
+      if (!state.reader) {
+        std::unique_ptr<VideoReader> reader = VideoReader::create(
+            state.source.url,
+            state.source.parameter_pairs,
+            state.source.extras,
+            this->alloc_callback,
+            this->dealloc_callback,
+            this->log_callback,
+            this->userdata);
+        state.realtime = !reader->is_seekable();
+        std::lock_guard<std::mutex> guard(this->mutex);
+        state.reader = std::move(reader);
+        if (this->stop_requested) {
+          state.reader->stop();
+        }
+      }
+      VideoReader::FrameUP frame = state.reader->next_frame();
+      std::lock_guard<std::mutex> guard(this->mutex);
+      if (!frame && state.reader->would_block() && !this->stop_requested) {
+        this->polls.emplace_back(
+            std::chrono::steady_clock::now() + POLL_INTERVAL, idx);
+        this->poll_cv.notify_one();
+        return;
+      }
+      if (!frame) {
+        this->end(state);
+        return;
+      }
+      if (state.realtime && state.frames.size() >= this->queue_frames) {
+        // its `ready` entry stands for the new frame now
+        dropped = std::move(state.frames.front());
+        state.frames.pop_front();
+        ++state.dropped;
+      } else {
+        this->ready.push_back(idx);
+      }
+      state.frames.push_back(std::move(frame));
+      this->cv.notify_all();
+      if (this->stop_requested ||
+          (!state.realtime && state.frames.size() >= this->queue_frames)) {
+        state.running = false;  // `take` resumes it
+        return;
+      }
+    } catch (std::exception const& e) {
+      this->fail(idx, e.what());
+      return;
+    } catch (...) {
+      this->fail(idx, "unknown error");
+      return;
+    }
+    this->pool->submit([this, idx] { this->step(idx); });
+  }
+
+  void fail(std::size_t idx, char const* what) {
+    if (this->log_callback) {
+      std::string const message =
+          "source " + std::to_string(idx) + " failed: " + what;
+      this->log_callback(
+          message.c_str(), VideoReader::LogLevel::ERROR, this->userdata);
+    }
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->sources[idx].error = std::current_exception();
+    this->end(this->sources[idx]);
+  }
+
+  // call with `mutex` locked
+  void end(SourceState& state) {
+    state.ended = true;
+    state.running = false;
+    --this->active;
+    this->cv.notify_all();
+  }
+
+  // pops the oldest frame of `idx`. Call with `mutex` locked
+  VideoReader::FrameUP take(std::size_t idx) {
+    SourceState& state = this->sources[idx];
+    VideoReader::FrameUP frame = std::move(state.frames.front());
+    state.frames.pop_front();
+    if (!state.running && !state.ended && !this->stop_requested) {
+      state.running = true;
+      this->pool->submit([this, idx] { this->step(idx); });
+    }
+    return frame;
+  }
+
+  VideoReader::FrameUP next_frame_any(std::size_t* source) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [this] {
+      return this->stop_requested || !this->ready.empty() ||
+             this->active == 0;
+    });
+    if (this->stop_requested || this->ready.empty()) {
+      return nullptr;
+    }
+    std::size_t const idx = this->ready.front();
+    this->ready.pop_front();
+    *source = idx;
+    return this->take(idx);
+  }
+
+  VideoReader::FrameUP next_frame(std::size_t idx) {
+    SourceState& state = this->sources.at(idx);
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [&] {
+      return this->stop_requested || !state.frames.empty() || state.ended;
+    });
+    if (this->stop_requested) {
+      return nullptr;
+    }
+    if (!state.frames.empty()) {
+      this->ready.erase(
+          std::find(this->ready.begin(), this->ready.end(), idx));
+      return this->take(idx);
+    }
+    if (state.error) {
+      std::rethrow_exception(state.error);
+    }
+    return nullptr;
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->stop_requested = true;
+    for (auto& state : this->sources) {
+      if (state.reader) {
+        state.reader->stop();
+      }
+    }
+    this->cv.notify_all();
+    this->poll_cv.notify_all();
+  }
+};
+
+VideoReaderGroup::VideoReaderGroup(
+    std::vector<Source> const& sources,
+    std::size_t threads,
+    std::size_t queue_frames,
+    VideoReader::AllocateCallback alloc_callback,
+    VideoReader::DeallocateCallback dealloc_callback,
+    VideoReader::LogCallback log_callback,
+    void* userdata) :
+    impl{std::make_unique<Impl>(
+        sources,
+        threads,
+        queue_frames,
+        alloc_callback,
+        dealloc_callback,
+        log_callback,
+        userdata)} {
+}
+
+VideoReaderGroup::~VideoReaderGroup() {
+  this->impl->stop();
+}
+
+std::size_t VideoReaderGroup::size() const {
+  return this->impl->sources.size();
+}
+
+VideoReader::FrameUP VideoReaderGroup::next_frame_any(std::size_t* source) {
+  return this->impl->next_frame_any(source);
+}
+
+VideoReader::FrameUP VideoReaderGroup::next_frame(std::size_t source) {
+  return this->impl->next_frame(source);
+}
+
+uint64_t VideoReaderGroup::dropped_frames(std::size_t source) const {
+  std::lock_guard<std::mutex> guard(this->impl->mutex);
+  return this->impl->sources.at(source).dropped;
+}
+
+void VideoReaderGroup::stop() {
+  this->impl->stop();
+}
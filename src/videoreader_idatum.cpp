@@ -252,6 +252,8 @@ struct VideoReaderIDatum::Impl {
                 width,  // stride
                 nullptr,  // data
                 nullptr,  // user_data
+                channels == 1 ? PIXEL_FORMAT::GRAY8
+                              : PIXEL_FORMAT::RGB24,  // pixel_format
             },
             number,
             timestamp_s));
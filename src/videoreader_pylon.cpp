@@ -13,6 +13,7 @@
 #include <pylon/TlFactory.h>
 #include <pylon/gige/BaslerGigECamera.h>
 #endif
+#include "row_alignment.hpp"
 #include "spinlock.hpp"
 #include <deque>
 #include <mutex>
@@ -28,15 +29,18 @@ struct VideoReaderPylon::Impl {
   AllocateCallback allocate_callback;
   DeallocateCallback deallocate_callback;
   void* userdata;
+  int32_t row_alignment;  // "alignment"
 
   Impl(
       AllocateCallback allocate_callback,
       DeallocateCallback deallocate_callback,
-      void* userdata) :
+      void* userdata,
+      int32_t row_alignment) :
       stop_requested{false},
       allocate_callback{allocate_callback},
       deallocate_callback{deallocate_callback},
-      userdata{userdata} {
+      userdata{userdata},
+      row_alignment{row_alignment} {
     this->converter.OutputPixelFormat = Pylon::PixelType_RGB8packed;
     this->converter.OutputBitAlignment = Pylon::OutputBitAlignment_MsbAligned;
     this->camera.Attach(Pylon::CTlFactory::GetInstance().CreateFirstDevice());
@@ -102,9 +106,8 @@ struct VideoReaderPylon::Impl {
     }
     int32_t const width = static_cast<int32_t>(result->GetWidth());
     int32_t const height = static_cast<int32_t>(result->GetHeight());
-    int32_t const alignment = 16;
     int32_t const preferred_stride =
-        (width * 3 + alignment - 1) & ~(alignment - 1);
+        aligned_stride(width * 3, this->row_alignment);
 
     Frame::number_t const number = result->GetBlockID();
     Frame::timestamp_s_t const timestamp_s = result->GetTimeStamp() / 1000.0;
@@ -119,7 +122,8 @@ struct VideoReaderPylon::Impl {
             SCALAR_TYPE::U8,  // scalar_type;
             preferred_stride,  // stride
             nullptr,  // data
-            nullptr  // user_data
+            nullptr,  // user_data
+            PIXEL_FORMAT::RGB24,  // pixel_format
         },
         number,
         timestamp_s));
@@ -129,6 +133,7 @@ struct VideoReaderPylon::Impl {
       if (!img->data) {
         throw std::runtime_error("Failed to allocate image for pylon");
       }
+      this->converter.OutputPaddingX = img->stride - width * 3;
       this->converter.Convert(img->data, img->stride * img->height, result);
     }
     return frame;
@@ -146,9 +151,15 @@ VideoReaderPylon::VideoReaderPylon(
   if (!extras.empty()) {
     throw std::runtime_error("extras not supported in pylon (yet)");
   }
+  int32_t row_alignment = DEFAULT_ROW_ALIGNMENT;
+  for (std::size_t idx = 0; idx + 1 < parameter_pairs.size(); idx += 2) {
+    if (parameter_pairs[idx] == "alignment") {
+      row_alignment = check_row_alignment(std::stoll(parameter_pairs[idx + 1]));
+    }
+  }
   Pylon::PylonInitialize();
-  this->impl =
-      std::unique_ptr<Impl>(new Impl{allocate_cb, deallocate_cb, userdata});
+  this->impl = std::unique_ptr<Impl>(
+      new Impl{allocate_cb, deallocate_cb, userdata, row_alignment});
 }
 
 bool VideoReaderPylon::is_seekable() const {
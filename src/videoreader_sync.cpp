@@ -0,0 +1,209 @@
+#include <algorithm>  // std::max, std::min
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <stdexcept>  // std::runtime_error
+#include <thread>
+#include <videoreader/videoreader_sync.hpp>
+
+struct VideoReaderSync::Impl {
+  struct Source {
+    std::unique_ptr<VideoReader> reader;
+    bool realtime;
+    std::thread thread;
+    // guarded by `Impl::mutex`
+    std::deque<VideoReader::FrameUP> frames;
+    bool ended = false;
+    std::exception_ptr error;
+    uint64_t dropped = 0;
+  };
+
+  double const tolerance_s;
+  std::size_t const buffer_frames;
+  std::vector<Source> sources;
+
+  std::mutex mutex;  // guards everything below and `Source` queues
+  std::condition_variable frame_cv;  // a frame was queued, a reader ended
+  std::condition_variable space_cv;  // a queue has space
+  bool stop_requested = false;
+
+  Impl(
+      std::vector<std::unique_ptr<VideoReader>> readers,
+      double tolerance_s,
+      std::size_t buffer_frames) :
+      tolerance_s{tolerance_s},
+      buffer_frames{buffer_frames},
+      sources(readers.size()) {
+    if (readers.empty()) {
+      throw std::runtime_error("VideoReaderSync requires readers");
+    }
+    if (!(tolerance_s >= 0.0)) {
+      throw std::runtime_error("tolerance must not be negative");
+    }
+    if (buffer_frames == 0) {
+      throw std::runtime_error("buffer_frames must be positive");
+    }
+    for (std::size_t idx = 0; idx < readers.size(); ++idx) {
+      if (!readers[idx]) {
+        throw std::runtime_error("reader is nullptr");
+      }
+      this->sources[idx].realtime = !readers[idx]->is_seekable();
+      this->sources[idx].reader = std::move(readers[idx]);
+    }
+    for (std::size_t idx = 0; idx < this->sources.size(); ++idx) {
+      this->sources[idx].thread = std::thread(&Impl::read, this, idx);
+    }
+  }
+
+  ~Impl() {
+    this->stop();
+    for (auto& source : this->sources) {
+      if (source.thread.joinable()) {
+        source.thread.join();
+      }
+    }
+  }
+
+  void read(std::size_t idx) {
+    Source& source = this->sources[idx];
+    try {
+      while (true) {
+        VideoReader::FrameUP frame = source.reader->next_frame();
+        VideoReader::FrameUP dropped;  // freed outside of the lock
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (!frame || this->stop_requested) {
+          source.ended = true;
+          this->frame_cv.notify_all();
+          return;
+        }
+        if (source.frames.size() >= this->buffer_frames) {
+          if (source.realtime) {
+            dropped = std::move(source.frames.front());
+            source.frames.pop_front();
+            ++source.dropped;
+          } else {
+            this->space_cv.wait(lock, [&] {
+              return this->stop_requested ||
+                     source.frames.size() < this->buffer_frames;
+            });
+            if (this->stop_requested) {
+              return;
+            }
+          }
+        }
+        source.frames.push_back(std::move(frame));
+        this->frame_cv.notify_all();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(this->mutex);
+      source.error = std::current_exception();
+      source.ended = true;
+      this->frame_cv.notify_all();
+    }
+  }
+
+  // call with `mutex` locked
+  void drop_front(Source& source, std::vector<VideoReader::FrameUP>& out) {
+    out.push_back(std::move(source.frames.front()));
+    source.frames.pop_front();
+    ++source.dropped;
+  }
+
+  std::vector<VideoReader::FrameUP> next_frames() {
+    std::vector<VideoReader::FrameUP> dropped;  // freed outside of the lock
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+      this->frame_cv.wait(lock, [this] {
+        if (this->stop_requested) {
+          return true;
+        }
+        for (auto const& source : this->sources) {
+          if (source.frames.empty() && !source.ended) {
+            return false;
+          }
+        }
+        return true;
+      });
+      if (this->stop_requested) {
+        return {};
+      }
+      double newest = -std::numeric_limits<double>::infinity();
+      double oldest = std::numeric_limits<double>::infinity();
+      for (auto const& source : this->sources) {
+        if (source.frames.empty()) {  // the reader ended
+          if (source.error) {
+            std::rethrow_exception(source.error);
+          }
+          return {};
+        }
+        double const timestamp_s = source.frames.front()->timestamp_s;
+        newest = std::max(newest, timestamp_s);
+        oldest = std::min(oldest, timestamp_s);
+      }
+      if (newest - oldest <= this->tolerance_s) {
+        std::vector<VideoReader::FrameUP> frames;
+        for (auto& source : this->sources) {
+          // the spread can only shrink, and newer frames mean less latency
+          while (source.frames.size() > 1 &&
+                 source.frames[1]->timestamp_s <= newest) {
+            this->drop_front(source, dropped);
+          }
+          frames.push_back(std::move(source.frames.front()));
+          source.frames.pop_front();
+        }
+        lock.unlock();
+        this->space_cv.notify_all();
+        return frames;
+      }
+      // frames of the newest reader are all at least `newest`,
+      // so these can't be in any tuple
+      for (auto& source : this->sources) {
+        while (!source.frames.empty() &&
+               source.frames.front()->timestamp_s <
+                   newest - this->tolerance_s) {
+          this->drop_front(source, dropped);
+        }
+      }
+      this->space_cv.notify_all();
+    }
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->stop_requested = true;
+    for (auto& source : this->sources) {
+      source.reader->stop();
+    }
+    this->frame_cv.notify_all();
+    this->space_cv.notify_all();
+  }
+};
+
+VideoReaderSync::VideoReaderSync(
+    std::vector<std::unique_ptr<VideoReader>> readers,
+    double tolerance_s,
+    std::size_t buffer_frames) :
+    impl{std::make_unique<Impl>(
+        std::move(readers), tolerance_s, buffer_frames)} {
+}
+
+VideoReaderSync::~VideoReaderSync() = default;
+
+std::size_t VideoReaderSync::size() const {
+  return this->impl->sources.size();
+}
+
+std::vector<VideoReader::FrameUP> VideoReaderSync::next_frames() {
+  return this->impl->next_frames();
+}
+
+uint64_t VideoReaderSync::dropped_frames(std::size_t idx) const {
+  std::lock_guard<std::mutex> guard(this->impl->mutex);
+  return this->impl->sources.at(idx).dropped;
+}
+
+void VideoReaderSync::stop() {
+  this->impl->stop();
+}
@@ -4,10 +4,11 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/opt.h>
-#include <libswscale/swscale.h>
 }
+#include "color_convert.hpp"  // rgb24_to_yuv420
 #include "ffmpeg_common.hpp"
-#include <charconv>  // std::from_chars
+#include "thread_pool.hpp"
+#include <algorithm>  // std::min
 #include <condition_variable>
 #include <deque>
 #include <optional>  // std::optional
@@ -46,7 +47,6 @@ struct VideoWriter::Impl {
 
   AVFrameUP frame;
 
-  SwsContextUP sws_ctx;
   AVFormatContextUP oc;
   VideoReader::VRImage m_frameTemplate;
 
@@ -57,6 +57,7 @@ struct VideoWriter::Impl {
   std::mutex m;
   std::exception_ptr exception;
   FFmpegLogInfo log_info;
+  std::unique_ptr<ThreadPool> conversion_pool;  // "conversion_threads"
 
   Impl(bool realtime, VideoReader::LogCallback log_callback, void* userdata) :
       pkt(av_packet_alloc()),
@@ -132,22 +133,56 @@ struct VideoWriter::Impl {
     }
   }
 
+  // converts `img` to `this->frame` in horizontal bands of even height
+  void convert(VideoReader::VRImage const& img) {
+    int const MIN_BAND_ROWS = 64;
+    std::size_t const bands =
+        this->conversion_pool ? std::min<std::size_t>(
+                                    this->conversion_pool->size(),
+                                    img.height / MIN_BAND_ROWS)
+                              : 1;
+    auto const convert_rows = [&](int row_begin, int row_end) {
+      AVFrame const* const frame = this->frame.get();
+      int const uv_row = row_begin / 2;
+      rgb24_to_yuv420(
+          img.data + static_cast<std::ptrdiff_t>(row_begin) * img.stride,
+          img.stride,
+          YUV420Planes{
+              frame->data[0] +
+                  static_cast<std::ptrdiff_t>(row_begin) * frame->linesize[0],
+              frame->data[1] +
+                  static_cast<std::ptrdiff_t>(uv_row) * frame->linesize[1],
+              frame->data[2] +
+                  static_cast<std::ptrdiff_t>(uv_row) * frame->linesize[2],
+              frame->linesize[0],
+              frame->linesize[1],
+              1},
+          img.width,
+          row_end - row_begin);
+    };
+    if (bands <= 1) {
+      convert_rows(0, img.height);
+      return;
+    }
+    int const band_rows =
+        ((img.height + static_cast<int>(bands) - 1) / static_cast<int>(bands) +
+         1) &
+        ~1;
+    this->conversion_pool->parallel_for(bands, [&](std::size_t band) {
+      int const row_begin = static_cast<int>(band) * band_rows;
+      int const row_end = std::min(row_begin + band_rows, img.height);
+      if (row_begin < row_end) {
+        convert_rows(row_begin, row_end);
+      }
+    });
+  }
+
   bool push(VideoReader::Frame const& frame) {
     VideoReader::VRImage const& img = frame.image;
     if (this->frame->width != img.width || this->frame->height != img.height) {
       throw std::runtime_error("can't change video frame size");
     }
-    if (const int ret = sws_scale(
-            this->sws_ctx.get(),
-            &img.data,
-            &img.stride,
-            0,
-            img.height,
-            this->frame->data,
-            this->frame->linesize);
-        ret < 0) {
-      throw std::runtime_error(format_error(ret, "sws_scale() failed"));
-    }
+    this->convert(img);
     if (this->exception) {
       std::rethrow_exception(this->exception);
     }
@@ -190,38 +225,6 @@ struct VideoWriter::Impl {
   }
 };
 
-static int64_t pop_value_int64(
-    AVDictionaryUP& dict, char const* key, int64_t const default_value) {
-  AVDictionaryEntry const* entry = av_dict_get(dict.get(), key, NULL, 0);
-  if (entry != nullptr) {
-    std::string const str{entry->value};
-    AVDictionary* raw_dict = dict.release();
-    av_dict_set(&raw_dict, key, NULL, 0);  // remove item
-    dict.reset(raw_dict);
-    int64_t result{};
-    auto [ptr, ec] =
-        std::from_chars(str.data(), str.data() + str.size(), result);
-    if (ec == std::errc()) {
-      return result;
-    }
-    throw std::runtime_error("`" + str + "` is not a valid int64");
-  }
-  return default_value;
-}
-
-static std::string pop_value_string(
-    AVDictionaryUP& dict, char const* key, std::string&& default_value) {
-  AVDictionaryEntry const* entry = av_dict_get(dict.get(), key, NULL, 0);
-  if (entry != nullptr) {
-    std::string const str{entry->value};
-    AVDictionary* raw_dict = dict.release();
-    av_dict_set(&raw_dict, key, NULL, 0);  // remove item
-    dict.reset(raw_dict);
-    return str;
-  }
-  return default_value;
-}
-
 VideoWriter::VideoWriter(
     std::string const& uri,
     VideoReader::VRImage const& format,
@@ -233,21 +236,6 @@ VideoWriter::VideoWriter(
   if (log_callback != nullptr) {
     av_log_set_callback(videoreader_ffmpeg_callback);
   }
-  this->impl->sws_ctx.reset(sws_getContext(
-      format.width,
-      format.height,
-      AV_PIX_FMT_RGB24 /* from */,
-      format.width,
-      format.height,
-      AV_PIX_FMT_YUV420P /* to */,
-      SWS_BICUBIC,
-      NULL,
-      NULL,
-      NULL));
-  if (!this->impl->sws_ctx) {
-    throw std::runtime_error("sws_getContext() failed");
-  }
-
   auto options = _create_dict_from_params_vec(parameter_pairs);
   char format_name[] = "matroska";
   std::string const encoder_name =
@@ -302,6 +290,12 @@ VideoWriter::VideoWriter(
   // c->codec_id = oc_->oformat->video_codec;
   c->codec_id = codec->id;
   c->bit_rate = pop_value_int64(options, "br", 4000000);  // bits per second
+  int64_t const conversion_threads =
+      pop_value_int64(options, "conversion_threads", 1);
+  if (conversion_threads > 1) {
+    this->impl->conversion_pool = std::make_unique<ThreadPool>(
+        static_cast<std::size_t>(conversion_threads));
+  }
   c->width = format.width;
   c->height = format.height;
   this->impl->st->time_base =
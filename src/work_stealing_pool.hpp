@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads for many small independent tasks. Every thread has
+// its own queue and runs its tasks oldest first. An idle thread steals the
+// newest task of another thread before going to sleep
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(std::size_t threads) {
+    if (threads == 0) {
+      threads = 1;
+    }
+    for (std::size_t idx = 0; idx < threads; ++idx) {
+      this->queues.push_back(std::make_unique<Queue>());
+    }
+    for (std::size_t idx = 0; idx < threads; ++idx) {
+      this->workers.emplace_back(&WorkStealingPool::work, this, idx);
+    }
+  }
+
+  // queued tasks are dropped, running ones are waited for
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> guard(this->mutex);
+      this->stop_requested = true;
+    }
+    this->cv.notify_all();
+    for (auto& worker : this->workers) {
+      worker.join();
+    }
+  }
+
+  WorkStealingPool(WorkStealingPool const&) = delete;
+  WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+
+  std::size_t size() const {
+    return this->workers.size();
+  }
+
+  // a task submitted from a pool thread goes to its own queue,
+  // otherwise queues are picked round robin. Tasks must not throw
+  void submit(std::function<void()> task) {
+    std::size_t const idx = this == current_pool
+                                ? current_worker
+                                : this->next_queue.fetch_add(1) %
+                                      this->queues.size();
+    Queue& queue = *this->queues[idx];
+    {
+      std::lock_guard<std::mutex> guard(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+      ++this->pending;
+    }
+    {  // so a thread going to sleep can't miss `pending`
+      std::lock_guard<std::mutex> guard(this->mutex);
+    }
+    this->cv.notify_one();
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  bool try_pop(std::size_t idx, std::function<void()>& task) {
+    for (std::size_t offset = 0; offset < this->queues.size(); ++offset) {
+      Queue& queue = *this->queues[(idx + offset) % this->queues.size()];
+      std::lock_guard<std::mutex> guard(queue.mutex);
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      if (offset == 0) {  // own queue
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      } else {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      }
+      --this->pending;
+      return true;
+    }
+    return false;
+  }
+
+  void work(std::size_t idx) {
+    current_pool = this;
+    current_worker = idx;
+    std::function<void()> task;
+    while (true) {
+      if (this->try_pop(idx, task)) {
+        task();
+        task = nullptr;
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->cv.wait(lock, [this] {
+        return this->stop_requested || this->pending.load() != 0;
+      });
+      if (this->stop_requested) {
+        return;
+      }
+    }
+  }
+
+  static thread_local WorkStealingPool const* current_pool;
+  static thread_local std::size_t current_worker;
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<std::size_t> pending{0};  // tasks in `queues`
+  std::atomic<std::size_t> next_queue{0};  // for outside submissions
+  std::mutex mutex;  // for sleeping
+  std::condition_variable cv;  // new task or stop
+  bool stop_requested = false;
+};
+
+inline thread_local WorkStealingPool const* WorkStealingPool::current_pool =
+    nullptr;
+inline thread_local std::size_t WorkStealingPool::current_worker = 0;
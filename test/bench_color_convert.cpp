@@ -0,0 +1,162 @@
+// Measures `yuv420_to_rgb24` and `rgb24_to_yuv420` speed for every
+// instruction set the cpu supports, on frames of a real video. Speedups
+// are over `sws_scale` with SWS_BICUBIC, the conversion these kernels
+// replace, or over the scalar kernel when built without ffmpeg.
+//
+//   bench_color_convert [video_path] [frames]
+#include "color_convert.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>  // std::atoi
+#include <string>
+#include <vector>
+#include <videoreader/videoreader.hpp>
+#ifdef VIDEOREADER_WITH_FFMPEG
+extern "C" {
+#include <libswscale/swscale.h>
+}
+#endif
+
+struct DecodedFrame {
+  std::vector<uint8_t> yuv;  // `PIXEL_FORMAT::YUV420P` layout
+  int width, height, stride;
+
+  YUV420Planes planes() {
+    uint8_t* const u = this->yuv.data() + this->stride * this->height;
+    return YUV420Planes{
+        this->yuv.data(),
+        u,
+        u + this->stride / 2 * (this->height / 2),
+        this->stride,
+        this->stride / 2,
+        1};
+  }
+};
+
+// milliseconds per frame of `convert(frame)` over all `frames`
+template <typename Convert>
+static double
+_ms_per_frame(std::vector<DecodedFrame>& frames, Convert convert) {
+  auto const start = std::chrono::steady_clock::now();
+  for (auto& frame : frames) {
+    convert(frame);
+  }
+  std::chrono::duration<double, std::milli> const elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / frames.size();
+}
+
+static void
+_print_row(char const* name, double const ms[2], double const baseline[2]) {
+  std::printf(
+      "%-9s yuv420p->rgb24 %.3f ms/frame (x%.1f), "
+      "rgb24->yuv420p %.3f ms/frame (x%.1f)\n",
+      name,
+      ms[0],
+      baseline[0] / ms[0],
+      ms[1],
+      baseline[1] / ms[1]);
+}
+
+int main(int argc, char** argv) {
+  std::string const path = argc > 1 ? argv[1] : TEST_VIDEOPATH;
+  std::size_t const max_frames = argc > 2 ? std::atoi(argv[2]) : 100;
+
+  std::vector<DecodedFrame> frames;
+  auto reader = VideoReader::create(path, {"output_format", "yuv420p"});
+  while (frames.size() < max_frames) {
+    auto frame = reader->next_frame();
+    if (!frame) {
+      break;
+    }
+    VideoReader::VRImage const& image = frame->image;
+    int const height = image.height * 2 / 3;
+    frames.push_back(DecodedFrame{
+        {image.data, image.data + image.stride * image.height},
+        image.width,
+        height,
+        image.stride});
+  }
+  if (frames.empty()) {
+    std::fprintf(stderr, "no frames in `%s`\n", path.c_str());
+    return 1;
+  }
+  int const width = frames[0].width;
+  int const height = frames[0].height;
+  std::printf("%zu frames %dx%d\n", frames.size(), width, height);
+
+  std::vector<uint8_t> rgb(width * height * 3);
+  double baseline_ms[2]{};  // yuv -> rgb, rgb -> yuv
+#ifdef VIDEOREADER_WITH_FFMPEG
+  SwsContext* const to_rgb = sws_getContext(
+      width,
+      height,
+      AV_PIX_FMT_YUV420P,
+      width,
+      height,
+      AV_PIX_FMT_RGB24,
+      SWS_BICUBIC,
+      nullptr,
+      nullptr,
+      nullptr);
+  SwsContext* const to_yuv = sws_getContext(
+      width,
+      height,
+      AV_PIX_FMT_RGB24,
+      width,
+      height,
+      AV_PIX_FMT_YUV420P,
+      SWS_BICUBIC,
+      nullptr,
+      nullptr,
+      nullptr);
+  if (!to_rgb || !to_yuv) {
+    std::fprintf(stderr, "sws_getContext failed\n");
+    return 1;
+  }
+  int const rgb_stride = width * 3;
+  baseline_ms[0] = _ms_per_frame(frames, [&](DecodedFrame& frame) {
+    YUV420Planes const planes = frame.planes();
+    uint8_t const* const src[] = {planes.y, planes.u, planes.v};
+    int const src_stride[] = {
+        planes.y_stride, planes.uv_stride, planes.uv_stride};
+    uint8_t* const dst[] = {rgb.data()};
+    sws_scale(to_rgb, src, src_stride, 0, height, dst, &rgb_stride);
+  });
+  baseline_ms[1] = _ms_per_frame(frames, [&](DecodedFrame& frame) {
+    YUV420Planes const planes = frame.planes();
+    uint8_t const* const src[] = {rgb.data()};
+    uint8_t* const dst[] = {planes.y, planes.u, planes.v};
+    int const dst_stride[] = {
+        planes.y_stride, planes.uv_stride, planes.uv_stride};
+    sws_scale(to_yuv, src, &rgb_stride, 0, height, dst, dst_stride);
+  });
+  sws_freeContext(to_rgb);
+  sws_freeContext(to_yuv);
+  _print_row("sws_scale", baseline_ms, baseline_ms);
+#endif
+  for (ColorConvertISA isa :
+       {ColorConvertISA::SCALAR,
+        ColorConvertISA::SSE41,
+        ColorConvertISA::AVX2}) {
+    if (!color_convert_isa_supported(isa)) {
+      continue;
+    }
+    double ms[2]{};
+    ms[0] = _ms_per_frame(frames, [&](DecodedFrame& frame) {
+      yuv420_to_rgb24(
+          frame.planes(), rgb.data(), width * 3, width, height, isa);
+    });
+    ms[1] = _ms_per_frame(frames, [&](DecodedFrame& frame) {
+      rgb24_to_yuv420(
+          rgb.data(), width * 3, frame.planes(), width, height, isa);
+    });
+    if (baseline_ms[0] == 0.0) {  // no sws_scale, compare to scalar
+      baseline_ms[0] = ms[0];
+      baseline_ms[1] = ms[1];
+    }
+    char const* const names[] = {"scalar", "sse4.1", "avx2"};
+    _print_row(names[static_cast<int>(isa)], ms, baseline_ms);
+  }
+  return 0;
+}
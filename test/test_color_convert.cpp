@@ -0,0 +1,147 @@
+#include "color_convert.hpp"
+#include <algorithm>  // std::fill
+#include <cstdlib>  // std::abs
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+struct TestYUV420 {
+  std::vector<uint8_t> y, uv;
+  YUV420Planes planes;
+
+  TestYUV420(int width, int height, int uv_step) {
+    int const chroma_width = (width + 1) / 2;
+    int const chroma_height = (height + 1) / 2;
+    y.resize(width * height);
+    uv.resize(chroma_width * chroma_height * 2);
+    planes.y = y.data();
+    planes.y_stride = width;
+    planes.uv_step = uv_step;
+    if (uv_step == 1) {
+      planes.u = uv.data();
+      planes.v = uv.data() + chroma_width * chroma_height;
+      planes.uv_stride = chroma_width;
+    } else {
+      planes.u = uv.data();
+      planes.v = uv.data() + 1;
+      planes.uv_stride = chroma_width * 2;
+    }
+  }
+};
+
+static void fill_random(std::vector<uint8_t>& data, unsigned seed) {
+  std::mt19937 generator{seed};
+  for (auto& value : data) {
+    value = static_cast<uint8_t>(generator());
+  }
+}
+
+TEST(TestColorConvert, KnownColors) {
+  TestYUV420 yuv(2, 2, 1);
+  struct {
+    uint8_t y, u, v;
+    uint8_t r, g, b;
+  } const cases[] = {
+      {16, 128, 128, 0, 0, 0},
+      {235, 128, 128, 255, 255, 255},
+      {126, 128, 128, 128, 128, 128},
+      {81, 90, 240, 255, 0, 0},
+  };
+  for (auto const& test_case : cases) {
+    std::fill(yuv.y.begin(), yuv.y.end(), test_case.y);
+    yuv.uv[0] = test_case.u;
+    yuv.uv[1] = test_case.v;
+    uint8_t rgb[12];
+    yuv420_to_rgb24(yuv.planes, rgb, 6, 2, 2, ColorConvertISA::SCALAR);
+    EXPECT_EQ(rgb[0], test_case.r);
+    EXPECT_EQ(rgb[1], test_case.g);
+    EXPECT_EQ(rgb[2], test_case.b);
+  }
+}
+
+TEST(TestColorConvert, RoundTrip) {
+  int const width = 64, height = 4;
+  std::vector<uint8_t> rgb(width * height * 3);
+  for (std::size_t idx = 0; idx < rgb.size(); idx += 3) {  // flat areas
+    rgb[idx] = static_cast<uint8_t>(idx / 12 * 7);
+    rgb[idx + 1] = static_cast<uint8_t>(idx / 12 * 3);
+    rgb[idx + 2] = static_cast<uint8_t>(255 - idx / 12 * 5);
+  }
+  for (std::size_t idx = 0; idx < rgb.size(); ++idx) {
+    rgb[idx] = rgb[(idx / (width * 3)) % 2 ? idx - width * 3 : idx];
+  }
+  TestYUV420 yuv(width, height, 1);
+  rgb24_to_yuv420(
+      rgb.data(),
+      width * 3,
+      yuv.planes,
+      width,
+      height,
+      ColorConvertISA::SCALAR);
+  std::vector<uint8_t> restored(rgb.size());
+  yuv420_to_rgb24(
+      yuv.planes,
+      restored.data(),
+      width * 3,
+      width,
+      height,
+      ColorConvertISA::SCALAR);
+  for (std::size_t idx = 0; idx < rgb.size(); ++idx) {
+    ASSERT_LE(std::abs(rgb[idx] - restored[idx]), 3) << "at " << idx;
+  }
+}
+
+// every SIMD implementation must be bit exact with the scalar one
+TEST(TestColorConvert, SIMDMatchesScalar) {
+  for (ColorConvertISA isa : {ColorConvertISA::SSE41, ColorConvertISA::AVX2}) {
+    if (!color_convert_isa_supported(isa)) {
+      continue;
+    }
+    for (int uv_step : {1, 2}) {
+      for (int width : {1, 2, 15, 16, 17, 31, 32, 33, 63, 640}) {
+        for (int height : {1, 2, 3, 7}) {
+          SCOPED_TRACE(
+              "isa " + std::to_string(static_cast<int>(isa)) + ", step " +
+              std::to_string(uv_step) + ", " + std::to_string(width) + "x" +
+              std::to_string(height));
+          TestYUV420 yuv(width, height, uv_step);
+          fill_random(yuv.y, width);
+          fill_random(yuv.uv, height);
+          std::vector<uint8_t> expected(width * height * 3);
+          std::vector<uint8_t> actual(width * height * 3);
+          yuv420_to_rgb24(
+              yuv.planes,
+              expected.data(),
+              width * 3,
+              width,
+              height,
+              ColorConvertISA::SCALAR);
+          yuv420_to_rgb24(
+              yuv.planes, actual.data(), width * 3, width, height, isa);
+          ASSERT_EQ(expected, actual);
+
+          std::vector<uint8_t> rgb(width * height * 3);
+          fill_random(rgb, width * height);
+          TestYUV420 expected_yuv(width, height, uv_step);
+          TestYUV420 actual_yuv(width, height, uv_step);
+          rgb24_to_yuv420(
+              rgb.data(),
+              width * 3,
+              expected_yuv.planes,
+              width,
+              height,
+              ColorConvertISA::SCALAR);
+          rgb24_to_yuv420(
+              rgb.data(), width * 3, actual_yuv.planes, width, height, isa);
+          ASSERT_EQ(expected_yuv.y, actual_yuv.y);
+          ASSERT_EQ(expected_yuv.uv, actual_yuv.uv);
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
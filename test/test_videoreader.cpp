@@ -1,7 +1,23 @@
 #include <videoreader/videoreader.hpp>
+#include <videoreader/videoreader_group.hpp>
+#include <videoreader/videowriter.hpp>
 #include <string>
+#include <algorithm>  // std::binary_search, std::equal, std::sort
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>  // SIZE_MAX
+#include <cstdio>  // std::sscanf
+#include <cstring>  // std::memcpy
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <iterator>  // std::istreambuf_iterator
+#include <mutex>
+#include <new>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>  // std::pair
 
 TEST(TestVedeoreader, TestVideoFile) {
   auto video_reader = VideoReader::create(TEST_VIDEOPATH, {
@@ -35,6 +51,240 @@ TEST(TestVedeoreader, TestVideoFile) {
   EXPECT_EQ(read_frame_count, 145UL);
 }
 
+TEST(TestVedeoreader, Seek) {
+  auto video_reader = VideoReader::create(TEST_VIDEOPATH);
+  for (VideoReader::Frame::number_t const number : {100UL, 3UL, 144UL, 0UL}) {
+    video_reader->seek(number);
+    auto frame = video_reader->next_frame();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->number, number);
+    EXPECT_EQ(frame->timestamp_s, number * 0.04);
+  }
+  EXPECT_EQ(video_reader->seek_time(1.0), 25UL);
+  for (VideoReader::Frame::number_t number = 25; number < 30; ++number) {
+    auto frame = video_reader->next_frame();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->number, number);
+  }
+}
+
+TEST(TestVedeoreader, ReadQueueLimits) {
+  auto video_reader = VideoReader::create(
+      TEST_VIDEOPATH, {"read_queue_packets", "2", "read_queue_bytes", "1000"});
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame(false)) {
+    EXPECT_EQ(frame->number, read_frame_count);
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 145UL);
+}
+
+TEST(TestVedeoreader, SkipWithoutDecoding) {
+  static int allocations;
+  allocations = 0;
+  auto const allocate = [](VideoReader::VRImage* image, void*) {
+    image->data = new uint8_t[image->stride * image->height];
+    ++allocations;
+  };
+  auto const deallocate = [](VideoReader::VRImage* image, void*) {
+    delete[] image->data;
+  };
+  auto video_reader =
+      VideoReader::create(TEST_VIDEOPATH, {}, {}, allocate, deallocate);
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame(false)) {
+    EXPECT_EQ(frame->number, read_frame_count);
+    EXPECT_EQ(frame->timestamp_s, read_frame_count * 0.04);
+    EXPECT_EQ(frame->image.data, nullptr);
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 145UL);
+  auto batch = video_reader->next_frames(8, false);
+  EXPECT_EQ(batch.count, 0UL);
+  video_reader->seek(100);
+  batch = video_reader->next_frames(8, false);
+  ASSERT_EQ(batch.count, 8UL);
+  EXPECT_EQ(batch.numbers.front(), 100UL);
+  EXPECT_EQ(batch.tensor->image.data, nullptr);
+  EXPECT_EQ(allocations, 0);
+}
+
+TEST(TestVedeoreader, DecodeAhead) {
+  auto video_reader =
+      VideoReader::create(TEST_VIDEOPATH, {"decode_ahead", "4"});
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame()) {
+    EXPECT_EQ(frame->number, read_frame_count);
+    ASSERT_NE(frame->image.data, nullptr);
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 145UL);
+  video_reader->seek(100);
+  auto frame = video_reader->next_frame();
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->number, 100UL);
+}
+
+TEST(TestVedeoreader, OutputFormat) {
+  using PIXEL_FORMAT = VideoReader::PIXEL_FORMAT;
+  struct {
+    char const* name;
+    PIXEL_FORMAT format;
+    int32_t height;
+    int32_t channels;
+  } const cases[] = {
+      {"bgr24", PIXEL_FORMAT::BGR24, 480, 3},
+      {"rgba", PIXEL_FORMAT::RGBA, 480, 4},
+      {"gray8", PIXEL_FORMAT::GRAY8, 480, 1},
+      {"yuv420p", PIXEL_FORMAT::YUV420P, 720, 1},
+      {"nv12", PIXEL_FORMAT::NV12, 720, 1},
+  };
+  for (auto const& test_case : cases) {
+    auto video_reader =
+        VideoReader::create(TEST_VIDEOPATH, {"output_format", test_case.name});
+    auto frame = video_reader->next_frame();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->image.pixel_format, test_case.format);
+    EXPECT_EQ(frame->image.width, 640);
+    EXPECT_EQ(frame->image.height, test_case.height);
+    EXPECT_EQ(frame->image.channels, test_case.channels);
+  }
+}
+
+TEST(TestVedeoreader, Alignment) {
+  auto video_reader = VideoReader::create(
+      TEST_VIDEOPATH, {"alignment", "64", "output_width", "100"});
+  auto frame = video_reader->next_frame();
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->image.stride, 320);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(frame->image.data) % 64, 0U);
+  EXPECT_THROW(
+      VideoReader::create(TEST_VIDEOPATH, {"alignment", "24"}),
+      std::runtime_error);
+}
+
+TEST(TestVedeoreader, ConversionThreads) {
+  auto expected_reader = VideoReader::create(TEST_VIDEOPATH);
+  auto actual_reader =
+      VideoReader::create(TEST_VIDEOPATH, {"conversion_threads", "4"});
+  for (int idx = 0; idx < 10; ++idx) {
+    auto expected = expected_reader->next_frame();
+    auto actual = actual_reader->next_frame();
+    ASSERT_TRUE(expected && actual);
+    VideoReader::VRImage const& image = expected->image;
+    ASSERT_EQ(actual->image.height, image.height);
+    ASSERT_EQ(actual->image.stride, image.stride);
+    std::size_t const size = image.stride * image.height;
+    EXPECT_TRUE(
+        std::equal(image.data, image.data + size, actual->image.data));
+  }
+}
+
+TEST(TestVedeoreader, ResizeAndCrop) {
+  struct {
+    std::vector<std::string> parameters;
+    int32_t width;
+    int32_t height;
+  } const cases[] = {
+      {{"output_width", "320", "output_height", "180"}, 320, 180},
+      {{"output_width", "320"}, 320, 240},
+      {{"crop", "10,20,300,200"}, 300, 200},
+      {{"crop", "0,0,320,240", "output_height", "120", "interpolation", "area"},
+       160,
+       120},
+  };
+  for (auto const& test_case : cases) {
+    auto video_reader =
+        VideoReader::create(TEST_VIDEOPATH, test_case.parameters);
+    uint64_t read_frame_count = 0;
+    while (auto frame = video_reader->next_frame()) {
+      EXPECT_EQ(frame->image.width, test_case.width);
+      EXPECT_EQ(frame->image.height, test_case.height);
+      ++read_frame_count;
+    }
+    EXPECT_EQ(read_frame_count, 145UL);
+  }
+  EXPECT_THROW(
+      VideoReader::create(TEST_VIDEOPATH, {"crop", "1,2,3"}),
+      std::runtime_error);
+}
+
+TEST(TestVedeoreader, Sampling) {
+  auto video_reader = VideoReader::create(TEST_VIDEOPATH, {"every_n", "5"});
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame()) {
+    EXPECT_EQ(frame->number, read_frame_count * 5);
+    EXPECT_EQ(frame->timestamp_s, read_frame_count * 5 * 0.04);
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 29UL);
+
+  video_reader = VideoReader::create(TEST_VIDEOPATH, {"target_fps", "5"});
+  read_frame_count = 0;
+  VideoReader::Frame::number_t last_number = 0;
+  while (auto frame = video_reader->next_frame()) {
+    if (read_frame_count != 0) {
+      EXPECT_GE(frame->number, last_number + 4);
+      EXPECT_LE(frame->number, last_number + 6);
+    }
+    last_number = frame->number;
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 29UL);
+  EXPECT_THROW(
+      VideoReader::create(TEST_VIDEOPATH, {"target_fps", "fast"}),
+      std::runtime_error);
+}
+
+TEST(TestVedeoreader, KeyframesOnly) {
+  auto video_reader =
+      VideoReader::create(TEST_VIDEOPATH, {"keyframes_only", "1"});
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame()) {
+    EXPECT_EQ(frame->number, 0UL);  // the clip is a single GOP
+    EXPECT_EQ(frame->timestamp_s, 0.0);
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 1UL);
+}
+
+TEST(TestVedeoreader, ZeroCopy) {
+  static int allocated;  // allocations minus deallocations
+  allocated = 0;
+  auto const allocate = [](VideoReader::VRImage* image, void*) {
+    std::size_t const size = image->stride * image->height;
+    image->data = new (std::align_val_t{64}) uint8_t[size];
+    ++allocated;
+  };
+  auto const deallocate = [](VideoReader::VRImage* image, void*) {
+    ::operator delete[](image->data, std::align_val_t{64});
+    --allocated;
+  };
+  for (char const* format : {"gray8", "yuv420p"}) {
+    {
+      auto video_reader = VideoReader::create(
+          TEST_VIDEOPATH,
+          {"zero_copy", "1", "output_format", format},
+          {},
+          allocate,
+          deallocate);
+      uint64_t read_frame_count = 0;
+      std::vector<VideoReader::FrameUP> frames;
+      while (auto frame = video_reader->next_frame()) {
+        EXPECT_EQ(frame->number, read_frame_count);
+        EXPECT_EQ(frame->image.width, 640);
+        ASSERT_NE(frame->image.data, nullptr);
+        if (read_frame_count < 8) {
+          frames.push_back(std::move(frame));  // kept alive past decoding
+        }
+        ++read_frame_count;
+      }
+      EXPECT_EQ(read_frame_count, 145UL);
+    }
+    EXPECT_EQ(allocated, 0);
+  }
+}
+
 #define EXPECT_THROW_WITH_MESSAGE(stmt, etype, whatstring) EXPECT_THROW( \
     try { \
         stmt; \
@@ -44,6 +294,194 @@ TEST(TestVedeoreader, TestVideoFile) {
     } \
 , etype)
 
+static std::vector<uint8_t> read_test_video(
+    std::string const& path = TEST_VIDEOPATH) {
+  std::ifstream file(path, std::ios::binary);
+  return {
+      std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+TEST(TestVedeoreader, FromMemory) {
+  std::vector<uint8_t> const data = read_test_video();
+  ASSERT_FALSE(data.empty());
+  auto video_reader = VideoReader::create_from_memory(data.data(), data.size());
+  EXPECT_TRUE(video_reader->is_seekable());
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame()) {
+    EXPECT_EQ(frame->number, read_frame_count);
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 145UL);
+  video_reader->seek(100);
+  auto frame = video_reader->next_frame();
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->number, 100UL);
+}
+
+TEST(TestVedeoreader, FromStream) {
+  struct Stream {
+    std::vector<uint8_t> data;
+    std::size_t position;
+  } stream{read_test_video(), 0};
+  VideoReader::StreamCallbacks callbacks{};
+  callbacks.read = [](uint8_t* buffer, std::size_t size, void* opaque) {
+    Stream& stream = *static_cast<Stream*>(opaque);
+    std::size_t const count =
+        std::min(size, stream.data.size() - stream.position);
+    std::copy_n(stream.data.data() + stream.position, count, buffer);
+    stream.position += count;
+    return static_cast<int64_t>(count);
+  };
+  callbacks.seek = [](int64_t position, void* opaque) {
+    static_cast<Stream*>(opaque)->position = static_cast<std::size_t>(position);
+    return position;
+  };
+  callbacks.size = static_cast<int64_t>(stream.data.size());
+  callbacks.opaque = &stream;
+  auto video_reader = VideoReader::create_from_stream(callbacks);
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame(false)) {
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 145UL);
+}
+
+TEST(TestVedeoreader, FileIO) {
+  for (char const* file_io : {"mmap", "readahead", "auto"}) {
+    auto video_reader = VideoReader::create(
+        TEST_VIDEOPATH, {"file_io", file_io, "io_buffer_size", "1000000"});
+    uint64_t read_frame_count = 0;
+    while (auto frame = video_reader->next_frame(false)) {
+      ++read_frame_count;
+    }
+    EXPECT_EQ(read_frame_count, 145UL) << file_io;
+    video_reader->seek(100);
+    auto frame = video_reader->next_frame();
+    ASSERT_TRUE(frame) << file_io;
+    EXPECT_EQ(frame->number, 100UL) << file_io;
+  }
+}
+
+TEST(TestVedeoreader, VideoStream) {
+  auto video_reader =
+      VideoReader::create(TEST_VIDEOPATH, {"video_stream", "best"});
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame(false)) {
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 145UL);
+  EXPECT_THROW(
+      VideoReader::create(TEST_VIDEOPATH, {"video_stream", "99"}),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoReader::create(TEST_VIDEOPATH, {"video_stream", "main"}),
+      std::runtime_error);
+}
+
+TEST(TestVedeoreader, ProbeCache) {
+  std::filesystem::path const directory =
+      std::filesystem::temp_directory_path() / "videoreader_probe_cache";
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  auto const log_callback =
+      [](char const* message, VideoReader::LogLevel, void* userdata) {
+        char result[8];  // "probe_cache: hit `<path>`"
+        if (std::sscanf(message, "probe_cache: %7s", result) == 1) {
+          static_cast<std::vector<std::string>*>(userdata)->push_back(result);
+        }
+      };
+  for (int attempt = 0; attempt < 2; ++attempt) {  // miss, then hit
+    std::vector<std::string> lookups;  // "hit" or "miss" of each open
+    auto video_reader = VideoReader::create(
+        TEST_VIDEOPATH,
+        {"probe_cache", directory.string()},
+        {},
+        nullptr,
+        nullptr,
+        log_callback,
+        &lookups);
+    // the second open reads the parameters instead of probing
+    EXPECT_EQ(
+        lookups,
+        std::vector<std::string>{attempt == 0 ? "miss" : "hit"});
+    uint64_t read_frame_count = 0;
+    while (auto frame = video_reader->next_frame()) {
+      EXPECT_EQ(frame->number, read_frame_count);
+      ++read_frame_count;
+    }
+    EXPECT_EQ(read_frame_count, 145UL) << attempt;
+    EXPECT_EQ(
+        std::distance(
+            std::filesystem::directory_iterator(directory),
+            std::filesystem::directory_iterator()),
+        1);
+  }
+  std::filesystem::remove_all(directory);
+}
+
+TEST(TestVedeoreader, Reopen) {
+  for (char const* decode_ahead : {"0", "4"}) {
+    auto video_reader =
+        VideoReader::create(TEST_VIDEOPATH, {"decode_ahead", decode_ahead});
+    for (int idx = 0; idx < 10; ++idx) {
+      ASSERT_TRUE(video_reader->next_frame());
+    }
+    EXPECT_THROW(
+        video_reader->reopen("/non/existent/path.mp4"), std::runtime_error);
+    auto frame = video_reader->next_frame();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->number, 10UL);  // still the previous video
+    for (int clip = 0; clip < 3; ++clip) {
+      video_reader->reopen(TEST_VIDEOPATH);
+      uint64_t read_frame_count = 0;
+      while (auto frame = video_reader->next_frame()) {
+        EXPECT_EQ(frame->number, read_frame_count);
+        ++read_frame_count;
+      }
+      EXPECT_EQ(read_frame_count, 145UL) << decode_ahead;
+    }
+  }
+}
+
+TEST(TestVedeoreader, Group) {
+  std::vector<VideoReaderGroup::Source> sources(3, {TEST_VIDEOPATH, {}, {}});
+  sources.push_back({"/non/existent/path.mp4", {}, {}});
+  VideoReaderGroup group(sources, 2, 4);
+  ASSERT_EQ(group.size(), 4UL);
+  std::vector<uint64_t> counts(group.size());
+  std::size_t source{};
+  while (auto frame = group.next_frame_any(&source)) {
+    ASSERT_LT(source, 3UL);
+    EXPECT_EQ(frame->number, counts[source]);
+    EXPECT_NE(frame->image.data, nullptr);
+    ++counts[source];
+  }
+  for (std::size_t idx = 0; idx < 3; ++idx) {
+    EXPECT_EQ(counts[idx], 145UL);
+    EXPECT_EQ(group.dropped_frames(idx), 0UL);
+    EXPECT_FALSE(group.next_frame(idx));
+  }
+  EXPECT_THROW(group.next_frame(3), std::runtime_error);
+}
+
+TEST(TestVedeoreader, GroupPerSource) {
+  VideoReaderGroup group(
+      {{TEST_VIDEOPATH, {"every_n", "10"}, {}},
+       {TEST_VIDEOPATH, {"output_format", "gray8"}, {}}},
+      1,
+      2);
+  uint64_t count = 0;
+  while (auto frame = group.next_frame(0)) {  // source 1 pauses meanwhile
+    EXPECT_EQ(frame->number, count * 10);
+    ++count;
+  }
+  EXPECT_EQ(count, 15UL);
+  auto frame = group.next_frame(1);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->number, 0UL);
+  EXPECT_EQ(frame->image.channels, 1);
+}
+
 TEST(TestVedeoreader, InvalidPath) {
   EXPECT_THROW_WITH_MESSAGE(
     VideoReader::create("invalid_path.mp4"),
@@ -60,6 +498,543 @@ TEST(TestVedeoreader, Arguments) {
   VideoReader::create(TEST_VIDEOPATH, {"threads", "2"});
 }
 
+TEST(TestVedeoreader, Index) {
+  std::string const index_path =
+      (std::filesystem::temp_directory_path() / "test_videoreader.vrindex")
+          .string();
+  std::filesystem::remove(index_path);
+  for (int attempt = 0; attempt < 2; ++attempt) {  // build, then load
+    auto video_reader =
+        VideoReader::create(TEST_VIDEOPATH, {"index", index_path});
+    EXPECT_TRUE(std::filesystem::exists(index_path));
+    EXPECT_EQ(video_reader->size(), 145UL);
+    video_reader->seek(77);
+    auto frame = video_reader->next_frame();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->number, 77UL);
+    EXPECT_EQ(frame->timestamp_s, 77 * 0.04);
+  }
+  std::filesystem::remove(index_path);
+}
+
+TEST(TestVedeoreader, IndexWithoutFile) {
+  std::string const index_path =
+      (std::filesystem::temp_directory_path() / "test_memory.vrindex")
+          .string();
+  std::filesystem::remove(index_path);
+  // the key of a video without a local file is its size and first packets
+  auto const key_size = [&] {
+    std::ifstream file(index_path, std::ios::binary);
+    file.seekg(8);  // `PacketIndexHeader::file_size`
+    uint64_t size{};
+    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+    return size;
+  };
+  std::vector<uint8_t> data = read_test_video();
+  for (int attempt = 0; attempt < 3; ++attempt) {  // build, load, rebuild
+    if (attempt == 2) {  // the video changes: a 16 byte mp4 `free` box
+      uint8_t const box[16] = {0, 0, 0, 16, 'f', 'r', 'e', 'e'};
+      data.insert(data.end(), std::begin(box), std::end(box));
+    }
+    auto video_reader = VideoReader::create_from_memory(
+        data.data(), data.size(), {"index", index_path});
+    EXPECT_EQ(video_reader->size(), 145UL);
+    EXPECT_EQ(key_size(), data.size());
+  }
+  std::filesystem::remove(index_path);
+}
+
+TEST(TestVedeoreader, SegmentWorkers) {
+  auto video_reader =
+      VideoReader::create(TEST_VIDEOPATH, {"segment_workers", "4"});
+  EXPECT_EQ(video_reader->size(), 145UL);
+  uint64_t read_frame_count = 0;
+  while (auto frame = video_reader->next_frame()) {
+    EXPECT_EQ(frame->number, read_frame_count);
+    EXPECT_EQ(frame->timestamp_s, read_frame_count * 0.04);
+    ++read_frame_count;
+  }
+  EXPECT_EQ(read_frame_count, 145UL);
+  video_reader->seek(100);
+  auto frame = video_reader->next_frame();
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->number, 100UL);
+}
+
+TEST(TestVedeoreader, SegmentWorkersMatchSequential) {
+  using Key = std::pair<VideoReader::Frame::number_t, double>;
+  std::vector<Key> expected;
+  auto sequential = VideoReader::create(TEST_VIDEOPATH, {"index", "memory"});
+  while (auto frame = sequential->next_frame()) {
+    expected.emplace_back(frame->number, frame->timestamp_s);
+  }
+  ASSERT_EQ(expected.size(), 145UL);
+  for (char const* workers : {"1", "2", "3", "8"}) {
+    auto video_reader =
+        VideoReader::create(TEST_VIDEOPATH, {"segment_workers", workers});
+    std::vector<Key> frames;
+    while (auto frame = video_reader->next_frame()) {
+      frames.emplace_back(frame->number, frame->timestamp_s);
+    }
+    EXPECT_EQ(frames, expected) << workers << " workers";
+    for (std::size_t const number : {0UL, 17UL, 63UL, 144UL}) {
+      video_reader->seek(number);
+      frames.clear();
+      while (auto frame = video_reader->next_frame()) {
+        frames.emplace_back(frame->number, frame->timestamp_s);
+      }
+      EXPECT_TRUE(std::equal(
+          frames.begin(),
+          frames.end(),
+          expected.begin() + number,
+          expected.end()))
+          << workers << " workers, seek to " << number;
+    }
+  }
+}
+
+TEST(TestVedeoreader, ReadQueueSeekHandshake) {
+  // every seek is a `SEEK_DONE` handshake through the packet ring,
+  // with the read thread parked on a full ring most of the time
+  for (char const* packets : {"1", "3", "100"}) {
+    auto video_reader =
+        VideoReader::create(TEST_VIDEOPATH, {"read_queue_packets", packets});
+    for (VideoReader::Frame::number_t const number :
+         {50UL, 10UL, 140UL, 0UL, 99UL, 100UL}) {
+      video_reader->seek(number);
+      for (auto expected = number; expected < std::min(number + 3, 145UL);
+           ++expected) {
+        auto frame = video_reader->next_frame(false);
+        ASSERT_TRUE(frame);
+        EXPECT_EQ(frame->number, expected) << packets << " packets";
+      }
+    }
+  }
+}
+
+TEST(TestVedeoreader, StopWakesConsumer) {
+  struct Stream {
+    std::vector<uint8_t> data;
+    std::size_t position;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool blocked;  // `read` waits, like a stalled network source
+  } stream{read_test_video(), 0, {}, {}, false};
+  VideoReader::StreamCallbacks callbacks{};
+  callbacks.read = [](uint8_t* buffer, std::size_t size, void* opaque) {
+    Stream& stream = *static_cast<Stream*>(opaque);
+    std::unique_lock<std::mutex> lock(stream.mutex);
+    stream.cv.wait(lock, [&] { return !stream.blocked; });
+    std::size_t const count =
+        std::min(size, stream.data.size() - stream.position);
+    std::copy_n(stream.data.data() + stream.position, count, buffer);
+    stream.position += count;
+    return static_cast<int64_t>(count);
+  };
+  callbacks.seek = [](int64_t position, void* opaque) {
+    Stream& stream = *static_cast<Stream*>(opaque);
+    std::lock_guard<std::mutex> guard(stream.mutex);
+    stream.position = static_cast<std::size_t>(position);
+    return position;
+  };
+  callbacks.size = static_cast<int64_t>(stream.data.size());
+  callbacks.opaque = &stream;
+  auto video_reader = VideoReader::create_from_stream(
+      callbacks, {"read_queue_packets", "1"});
+  {
+    std::lock_guard<std::mutex> guard(stream.mutex);
+    stream.blocked = true;
+  }
+  std::thread stopper([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    video_reader->stop();  // the consumer is parked on the empty ring
+  });
+  uint64_t read_frame_count = 0;
+  while (video_reader->next_frame(false)) {
+    ++read_frame_count;
+  }
+  EXPECT_LT(read_frame_count, 145UL);
+  stopper.join();
+  {
+    std::lock_guard<std::mutex> guard(stream.mutex);
+    stream.blocked = false;  // so the read thread can see the stop
+  }
+  stream.cv.notify_all();
+}
+
+TEST(TestVedeoreader, NextFrames) {
+  for (char const* decode_ahead : {"0", "4"}) {
+    auto video_reader =
+        VideoReader::create(TEST_VIDEOPATH, {"decode_ahead", decode_ahead});
+    auto single_reader = VideoReader::create(TEST_VIDEOPATH);
+    uint64_t read_frame_count = 0;
+    while (true) {
+      auto batch = video_reader->next_frames(16);
+      if (batch.count == 0) {
+        break;
+      }
+      ASSERT_LE(batch.count, 16UL);
+      VideoReader::VRImage const& tensor = batch.tensor->image;
+      EXPECT_EQ(tensor.height, batch.frame_height * 16);
+      for (std::size_t idx = 0; idx < batch.count; ++idx) {
+        EXPECT_EQ(batch.numbers[idx], read_frame_count);
+        auto frame = single_reader->next_frame();
+        ASSERT_TRUE(frame);
+        EXPECT_EQ(frame->timestamp_s, batch.timestamps_s[idx]);
+        std::size_t const size = frame->image.stride * frame->image.height;
+        EXPECT_TRUE(std::equal(
+            frame->image.data,
+            frame->image.data + size,
+            tensor.data + idx * size));
+        ++read_frame_count;
+      }
+    }
+    EXPECT_EQ(read_frame_count, 145UL);
+  }
+}
+
+TEST(TestVedeoreader, BufferPool) {
+  VideoReader::BufferPool pool(1 << 20);
+  uint8_t* const first = pool.acquire(640 * 480);
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(first) % 64, 0U);
+  pool.release(first);
+  EXPECT_GE(pool.retained_bytes(), 640U * 480U);
+  EXPECT_EQ(pool.acquire(640 * 480 - 100), first);  // same bucket
+  EXPECT_EQ(pool.retained_bytes(), 0U);
+  uint8_t* const large = pool.acquire(2 << 20);  // over the limit
+  pool.release(large);
+  pool.release(first);
+  EXPECT_LE(pool.retained_bytes(), std::size_t{1} << 20);
+  pool.clear();
+  EXPECT_EQ(pool.retained_bytes(), 0U);
+
+  auto video_reader = VideoReader::create(
+      TEST_VIDEOPATH,
+      {},
+      {},
+      VideoReader::BufferPool::allocate,
+      VideoReader::BufferPool::deallocate,
+      nullptr,
+      &pool);
+  uint8_t* previous_data = nullptr;
+  for (int idx = 0; idx < 3; ++idx) {
+    auto frame = video_reader->next_frame();
+    ASSERT_TRUE(frame);
+    if (previous_data) {
+      EXPECT_EQ(frame->image.data, previous_data);  // recycled
+    }
+    previous_data = frame->image.data;
+  }
+}
+
+// the bundled clip is a single GOP, these have a keyframe every
+// `MULTI_GOP_SIZE` frames. Written once per test run
+static VideoReader::Frame::number_t const MULTI_GOP_FRAMES = 100;
+static int const MULTI_GOP_SIZE = 10;
+
+static std::string write_multi_gop_video(
+    char const* name, std::vector<std::string> const& parameter_pairs) {
+  std::string const path =
+      (std::filesystem::temp_directory_path() / name).string();
+  int32_t const width = 160, height = 120;
+  std::vector<uint8_t> pixels(width * height * 3);
+  VideoReader::VRImage image{};
+  image.height = height;
+  image.width = width;
+  image.channels = 3;
+  image.scalar_type = VideoReader::SCALAR_TYPE::U8;
+  image.stride = width * 3;
+  image.data = pixels.data();
+  std::vector<std::string> options{
+      "g", std::to_string(MULTI_GOP_SIZE), "sc_threshold", "0"};
+  options.insert(options.end(), parameter_pairs.begin(), parameter_pairs.end());
+  VideoWriter writer(path, image, options);
+  for (VideoReader::Frame::number_t number = 0; number < MULTI_GOP_FRAMES;
+       ++number) {
+    for (int32_t y = 0; y < height; ++y) {  // a moving gradient
+      for (int32_t x = 0; x < width * 3; ++x) {
+        pixels[y * width * 3 + x] = static_cast<uint8_t>(x + y + number * 5);
+      }
+    }
+    writer.push(
+        VideoReader::Frame(nullptr, nullptr, image, number, number * 0.04));
+  }
+  writer.close();
+  return path;
+}
+
+// with B-frames, decoding order differs from presentation order
+static std::string const& multi_gop_video() {
+  static std::string const path =
+      write_multi_gop_video("test_multi_gop.mkv", {});
+  return path;
+}
+
+// the decoder returns a frame for every packet, without delay
+static std::string const& multi_gop_video_without_b_frames() {
+  static std::string const path =
+      write_multi_gop_video("test_multi_gop_no_b.mkv", {"bf", "0"});
+  return path;
+}
+
+// frame numbers of keyframes in an "index" sidecar
+static std::vector<VideoReader::Frame::number_t>
+index_keyframes(std::string const& index_path) {
+  std::ifstream file(index_path, std::ios::binary);
+  file.seekg(32);  // `PacketIndexHeader::count`
+  uint64_t count{};
+  file.read(reinterpret_cast<char*>(&count), sizeof(count));
+  std::vector<std::pair<int64_t, bool>> packets;  // pts, keyframe
+  for (uint64_t idx = 0; idx < count; ++idx) {
+    char entry[32];  // `PacketIndexEntry`
+    file.read(entry, sizeof(entry));
+    int64_t pts{};
+    int32_t flags{};
+    std::memcpy(&pts, entry, sizeof(pts));
+    std::memcpy(&flags, entry + 28, sizeof(flags));
+    packets.emplace_back(pts, flags & 1);  // AV_PKT_FLAG_KEY
+  }
+  std::sort(packets.begin(), packets.end());
+  std::vector<VideoReader::Frame::number_t> keyframes;
+  for (std::size_t number = 0; number < packets.size(); ++number) {
+    if (packets[number].second) {
+      keyframes.push_back(number);
+    }
+  }
+  return keyframes;
+}
+
+using DecodedFrame =
+    std::tuple<VideoReader::Frame::number_t, double, std::vector<uint8_t>>;
+
+// number, timestamp and pixels of up to `limit` next frames
+static std::vector<DecodedFrame>
+read_frames(VideoReader& video_reader, std::size_t limit = SIZE_MAX) {
+  std::vector<DecodedFrame> frames;
+  while (frames.size() < limit) {
+    auto frame = video_reader.next_frame();
+    if (!frame) {
+      break;
+    }
+    VideoReader::VRImage const& image = frame->image;
+    frames.emplace_back(
+        frame->number,
+        frame->timestamp_s,
+        std::vector<uint8_t>(
+            image.data, image.data + image.stride * image.height));
+  }
+  return frames;
+}
+
+TEST(TestVedeoreader, SeekAroundKeyframes) {
+  std::string const& path = multi_gop_video();
+  auto sequential = VideoReader::create(path);
+  std::vector<DecodedFrame> const expected = read_frames(*sequential);
+  ASSERT_EQ(expected.size(), MULTI_GOP_FRAMES);
+  std::string const index_path =
+      (std::filesystem::temp_directory_path() / "test_multi_gop.vrindex")
+          .string();
+  std::filesystem::remove(index_path);
+  auto video_reader = VideoReader::create(path, {"index", index_path});
+  EXPECT_EQ(video_reader->size(), MULTI_GOP_FRAMES);
+  std::vector<VideoReader::Frame::number_t> const keyframes =
+      index_keyframes(index_path);
+  ASSERT_GT(keyframes.size(), 2UL);
+  EXPECT_EQ(keyframes[0], 0UL);
+  // from the last keyframe backwards, so every target is a new position
+  for (auto it = keyframes.rbegin(); it != keyframes.rend(); ++it) {
+    for (auto const number : {*it + 1, *it, *it - 1}) {
+      if (number >= MULTI_GOP_FRAMES) {  // or `0 - 1`
+        continue;
+      }
+      video_reader->seek(number);
+      std::vector<DecodedFrame> const frames = read_frames(*video_reader, 2);
+      ASSERT_FALSE(frames.empty()) << "seek to " << number;
+      EXPECT_EQ(frames[0], expected[number]) << "seek to " << number;
+      if (number + 1 < MULTI_GOP_FRAMES) {
+        ASSERT_EQ(frames.size(), 2UL);
+        EXPECT_EQ(frames[1], expected[number + 1]) << "seek to " << number;
+      }
+    }
+  }
+  VideoReader::Frame::number_t const middle = keyframes[1] + 3;
+  EXPECT_EQ(video_reader->seek_time(std::get<1>(expected[middle])), middle);
+  EXPECT_EQ(read_frames(*video_reader, 1)[0], expected[middle]);
+  std::filesystem::remove(index_path);
+}
+
+TEST(TestVedeoreader, SegmentWorkersMultiGop) {
+  std::string const& path = multi_gop_video();
+  auto sequential = VideoReader::create(path);
+  std::vector<DecodedFrame> const expected = read_frames(*sequential);
+  ASSERT_EQ(expected.size(), MULTI_GOP_FRAMES);
+  std::string const index_path =
+      (std::filesystem::temp_directory_path() / "test_segments.vrindex")
+          .string();
+  std::filesystem::remove(index_path);
+  static std::size_t segments;  // from the log of `SegmentDecoder`
+  auto const log_callback =
+      [](char const* message, VideoReader::LogLevel, void*) {
+        std::sscanf(message, "segment_workers: %zu segments", &segments);
+      };
+  for (char const* workers : {"2", "3", "8"}) {
+    segments = 0;
+    auto video_reader = VideoReader::create(
+        path,
+        {"segment_workers", workers, "index", index_path},
+        {},
+        nullptr,
+        nullptr,
+        log_callback);
+    std::vector<VideoReader::Frame::number_t> const keyframes =
+        index_keyframes(index_path);
+    ASSERT_GT(keyframes.size(), 2UL);
+    // GOPs of 10 frames are shorter than `MIN_SEGMENT_FRAMES` and merged
+    EXPECT_GT(segments, 1UL) << workers << " workers";
+    EXPECT_LT(segments, keyframes.size()) << workers << " workers";
+    EXPECT_EQ(read_frames(*video_reader), expected) << workers << " workers";
+    VideoReader::Frame::number_t const targets[] = {
+        keyframes[1] + 4, keyframes[2] + 7, keyframes.back() - 1, 0};
+    for (auto const number : targets) {
+      video_reader->seek(number);
+      EXPECT_EQ(
+          read_frames(*video_reader),
+          std::vector<DecodedFrame>(expected.begin() + number, expected.end()))
+          << workers << " workers, seek to " << number;
+    }
+  }
+  std::filesystem::remove(index_path);
+}
+
+TEST(TestVedeoreader, RealtimeOverflow) {
+  // without B-frames every packet dropped up to a keyframe is a frame
+  // missing from the output, and the decoder holds no frames over a gap
+  std::string const& path = multi_gop_video_without_b_frames();
+  auto sequential = VideoReader::create(path);
+  std::vector<DecodedFrame> const expected = read_frames(*sequential);
+  ASSERT_EQ(expected.size(), MULTI_GOP_FRAMES);
+  std::string const index_path =
+      (std::filesystem::temp_directory_path() / "test_realtime.vrindex")
+          .string();
+  std::filesystem::remove(index_path);
+  VideoReader::create(path, {"index", index_path});
+  std::vector<VideoReader::Frame::number_t> const keyframes =
+      index_keyframes(index_path);
+  std::filesystem::remove(index_path);
+  ASSERT_GT(keyframes.size(), 2UL);
+
+  // the `read` thread waits at `gate`, so the consumer knows the queue
+  // overflowed while it wasn't reading
+  struct Stream {
+    std::vector<uint8_t> data;
+    std::size_t position;
+    std::size_t gate;
+    bool waiting;  // `read` waits for the `gate` to move
+    std::thread::id opener;  // probing in `create_from_stream` doesn't wait
+    std::mutex mutex;
+    std::condition_variable cv;
+  } stream{
+      read_test_video(path), 0, 0, false, std::this_thread::get_id(), {}, {}};
+  VideoReader::StreamCallbacks callbacks{};
+  callbacks.read = [](uint8_t* buffer, std::size_t size, void* opaque) {
+    Stream& stream = *static_cast<Stream*>(opaque);
+    std::unique_lock<std::mutex> lock(stream.mutex);
+    // small reads, so probing doesn't take the whole file
+    std::size_t end = std::min(
+        stream.data.size(),
+        stream.position + std::min(size, std::size_t{4096}));
+    if (std::this_thread::get_id() != stream.opener) {
+      stream.waiting = true;
+      stream.cv.notify_all();
+      stream.cv.wait(lock, [&] { return stream.position < stream.gate; });
+      stream.waiting = false;
+      end = std::min(end, stream.gate);
+    }
+    std::copy(
+        stream.data.data() + stream.position, stream.data.data() + end, buffer);
+    int64_t const count = static_cast<int64_t>(end - stream.position);
+    stream.position = end;
+    return count;
+  };
+  callbacks.size = static_cast<int64_t>(stream.data.size());
+  callbacks.opaque = &stream;
+  auto video_reader = VideoReader::create_from_stream(
+      callbacks, {"realtime", "1", "read_queue_packets", "4"});
+  {
+    std::unique_lock<std::mutex> lock(stream.mutex);
+    EXPECT_LT(stream.position, stream.data.size() / 2);
+    stream.gate = stream.position + (stream.data.size() - stream.position) / 2;
+    stream.cv.notify_all();
+    stream.cv.wait(lock, [&] {
+      return stream.waiting && stream.position == stream.gate;
+    });
+  }
+  // the queue keeps its first packets, the newer ones are dropped. One
+  // frame makes room for the keyframe decoding restarts from
+  std::vector<DecodedFrame> frames = read_frames(*video_reader, 1);
+  {
+    std::lock_guard<std::mutex> guard(stream.mutex);
+    stream.gate = SIZE_MAX;
+  }
+  stream.cv.notify_all();
+  std::vector<DecodedFrame> const rest = read_frames(*video_reader);
+  frames.insert(frames.end(), rest.begin(), rest.end());
+  EXPECT_LT(frames.size(), expected.size());
+  std::size_t gaps = 0;
+  VideoReader::Frame::number_t next = 0;
+  for (DecodedFrame const& frame : frames) {
+    VideoReader::Frame::number_t const number = std::get<0>(frame);
+    ASSERT_LT(number, expected.size());
+    EXPECT_EQ(frame, expected[number]);
+    EXPECT_GE(number, next);
+    if (number != next) {
+      ++gaps;
+      EXPECT_TRUE(
+          std::binary_search(keyframes.begin(), keyframes.end(), number))
+          << "gap before " << number;
+    }
+    next = number + 1;
+  }
+  EXPECT_GT(gaps, 0UL);
+
+  // offline handling of the same input loses nothing
+  video_reader = VideoReader::create_from_memory(
+      stream.data.data(),
+      stream.data.size(),
+      {"realtime", "0", "read_queue_packets", "4"});
+  EXPECT_EQ(read_frames(*video_reader), expected);
+}
+
+TEST(TestVedeoreader, KeyframesOnlyMultiGop) {
+  std::string const& path = multi_gop_video();
+  auto sequential = VideoReader::create(path);
+  std::vector<DecodedFrame> const expected = read_frames(*sequential);
+  ASSERT_EQ(expected.size(), MULTI_GOP_FRAMES);
+  std::string const index_path =
+      (std::filesystem::temp_directory_path() / "test_keyframes.vrindex")
+          .string();
+  std::filesystem::remove(index_path);
+  VideoReader::create(path, {"index", index_path});
+  std::vector<VideoReader::Frame::number_t> const keyframes =
+      index_keyframes(index_path);
+  ASSERT_GT(keyframes.size(), 2UL);
+  // numbers come from the index or from timestamps without it
+  for (std::string const& index : {index_path, std::string{}}) {
+    std::vector<std::string> parameters{"keyframes_only", "1"};
+    if (!index.empty()) {
+      parameters.insert(parameters.end(), {"index", index});
+    }
+    auto video_reader = VideoReader::create(path, parameters);
+    std::vector<DecodedFrame> const frames = read_frames(*video_reader);
+    ASSERT_EQ(frames.size(), keyframes.size()) << "index: " << index;
+    for (std::size_t idx = 0; idx < frames.size(); ++idx) {
+      EXPECT_EQ(frames[idx], expected[keyframes[idx]]) << "index: " << index;
+    }
+  }
+  std::filesystem::remove(index_path);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,210 @@
+#include <videoreader/videoreader_sync.hpp>
+#include <algorithm>  // std::max_element, std::min_element
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+static double const PERIOD_S = 1.0 / 30.0;
+static double const JITTER_S = 0.002;
+static double const TOLERANCE_S = 0.008;
+
+struct SyntheticFrame {
+  VideoReader::Frame::number_t number;
+  double timestamp_s;
+};
+
+// frames `first`..`first + count` of a 30 fps camera with `offset_s` clock
+// offset, jittered timestamps and `missing` share of frames lost
+static std::vector<SyntheticFrame> _schedule(
+    VideoReader::Frame::number_t first,
+    std::size_t count,
+    double offset_s,
+    double missing,
+    uint32_t seed) {
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<double> jitter{-JITTER_S, JITTER_S};
+  std::uniform_real_distribution<double> lost{0.0, 1.0};
+  std::vector<SyntheticFrame> frames;
+  for (auto number = first; number < first + count; ++number) {
+    double const timestamp_s = number * PERIOD_S + offset_s + jitter(rng);
+    if (lost(rng) >= missing) {
+      frames.push_back({number, timestamp_s});
+    }
+  }
+  return frames;
+}
+
+using Clock = std::chrono::steady_clock;
+
+// replays a schedule. A realtime reader is a camera running 33 times
+// faster: frame `number` is available `number` milliseconds after `epoch`
+class SyntheticReader : public VideoReader {
+public:
+  SyntheticReader(
+      std::vector<SyntheticFrame> frames,
+      Clock::time_point epoch = {},
+      std::size_t fail_after = SIZE_MAX) :
+      frames{std::move(frames)},
+      realtime{epoch != Clock::time_point{}},
+      epoch{epoch},
+      fail_after{fail_after} {
+  }
+
+  Frame::number_t size() const override {
+    return this->frames.size();
+  }
+
+  bool is_seekable() const override {
+    return !this->realtime;
+  }
+
+  FrameUP next_frame(bool) override {
+    if (this->stopped || this->idx == this->frames.size()) {
+      return nullptr;
+    }
+    if (this->idx == this->fail_after) {
+      throw std::runtime_error("camera disconnected");
+    }
+    SyntheticFrame const& frame = this->frames[this->idx++];
+    if (this->realtime) {
+      std::this_thread::sleep_until(
+          this->epoch + std::chrono::milliseconds(frame.number));
+    }
+    return std::make_unique<Frame>(
+        nullptr, nullptr, VRImage{}, frame.number, frame.timestamp_s);
+  }
+
+  void stop() override {
+    this->stopped = true;
+  }
+
+private:
+  std::vector<SyntheticFrame> const frames;
+  bool const realtime;
+  Clock::time_point const epoch;
+  std::size_t const fail_after;
+  std::size_t idx = 0;
+  std::atomic<bool> stopped{false};
+};
+
+static void _expect_aligned(
+    std::vector<VideoReader::FrameUP> const& frames,
+    std::size_t size) {
+  ASSERT_EQ(frames.size(), size);
+  auto const less = [](auto const& a, auto const& b) {
+    return a->timestamp_s < b->timestamp_s;
+  };
+  double const spread =
+      (*std::max_element(frames.begin(), frames.end(), less))->timestamp_s -
+      (*std::min_element(frames.begin(), frames.end(), less))->timestamp_s;
+  EXPECT_LE(spread, TOLERANCE_S);
+  for (auto const& frame : frames) {  // within tolerance means same shot
+    EXPECT_EQ(frame->number, frames[0]->number);
+  }
+}
+
+TEST(TestVedeoreader, SyncJittered) {
+  std::vector<std::vector<SyntheticFrame>> schedules{
+      _schedule(0, 300, 0.0, 0.05, 1),
+      _schedule(3, 300, 0.001, 0.05, 2),
+      _schedule(5, 280, -0.001, 0.05, 3)};
+  std::set<VideoReader::Frame::number_t> expected;  // shot by all cameras
+  for (auto const& frame : schedules[0]) {
+    expected.insert(frame.number);
+  }
+  for (std::size_t idx = 1; idx < schedules.size(); ++idx) {
+    std::set<VideoReader::Frame::number_t> common;
+    for (auto const& frame : schedules[idx]) {
+      if (expected.count(frame.number)) {
+        common.insert(frame.number);
+      }
+    }
+    expected = std::move(common);
+  }
+
+  std::vector<std::unique_ptr<VideoReader>> readers;
+  for (auto const& schedule : schedules) {
+    readers.push_back(std::make_unique<SyntheticReader>(schedule));
+  }
+  VideoReaderSync sync(std::move(readers), TOLERANCE_S, 4);
+  ASSERT_EQ(sync.size(), 3UL);
+  std::vector<VideoReader::Frame::number_t> numbers;
+  while (true) {
+    auto frames = sync.next_frames();
+    if (frames.empty()) {
+      break;
+    }
+    _expect_aligned(frames, 3);
+    numbers.push_back(frames[0]->number);
+  }
+  EXPECT_EQ(
+      numbers,
+      std::vector<VideoReader::Frame::number_t>(
+          expected.begin(), expected.end()));
+  for (std::size_t idx = 0; idx < schedules.size(); ++idx) {
+    EXPECT_GT(sync.dropped_frames(idx), 0UL);
+    EXPECT_LE(
+        sync.dropped_frames(idx), schedules[idx].size() - numbers.size());
+  }
+  EXPECT_TRUE(sync.next_frames().empty());
+}
+
+TEST(TestVedeoreader, SyncRealtime) {
+  Clock::time_point const epoch = Clock::now();
+  std::vector<std::unique_ptr<VideoReader>> readers;
+  readers.push_back(std::make_unique<SyntheticReader>(
+      _schedule(0, 5000, 0.0, 0.0, 4), epoch));
+  readers.push_back(std::make_unique<SyntheticReader>(
+      _schedule(0, 5000, 0.002, 0.1, 5), epoch));
+  VideoReaderSync sync(std::move(readers), TOLERANCE_S, 2);
+  VideoReader::Frame::number_t last_number = 0;
+  for (int tuple = 0; tuple < 20; ++tuple) {  // a slow consumer
+    auto frames = sync.next_frames();
+    _expect_aligned(frames, 2);
+    if (tuple != 0) {
+      EXPECT_GT(frames[0]->number, last_number);
+    }
+    last_number = frames[0]->number;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_GT(sync.dropped_frames(0), 0UL);
+  EXPECT_GT(sync.dropped_frames(1), 0UL);
+  std::thread stopper([&sync] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    sync.stop();
+  });
+  while (!sync.next_frames().empty()) {
+  }
+  stopper.join();
+}
+
+TEST(TestVedeoreader, SyncError) {
+  std::vector<std::unique_ptr<VideoReader>> readers;
+  readers.push_back(
+      std::make_unique<SyntheticReader>(_schedule(0, 100, 0.0, 0.0, 6)));
+  readers.push_back(std::make_unique<SyntheticReader>(
+      _schedule(0, 100, 0.0, 0.0, 7), Clock::time_point{}, 10));
+  VideoReaderSync sync(std::move(readers), TOLERANCE_S);
+  for (int tuple = 0; tuple < 10; ++tuple) {
+    _expect_aligned(sync.next_frames(), 2);
+  }
+  EXPECT_THROW(sync.next_frames(), std::runtime_error);
+}
+
+TEST(TestVedeoreader, SyncArguments) {
+  EXPECT_THROW(VideoReaderSync({}, TOLERANCE_S), std::runtime_error);
+  std::vector<std::unique_ptr<VideoReader>> readers;
+  readers.push_back(std::make_unique<SyntheticReader>(
+      std::vector<SyntheticFrame>{}));
+  EXPECT_THROW(
+      VideoReaderSync(std::move(readers), -1.0), std::runtime_error);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}